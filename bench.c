@@ -0,0 +1,1292 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2011 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+/* fswebcam-bench - Times the image processing code on synthetic
+ * images, without a camera. Each fast path is compared against a
+ * simple reference version and must give identical output.
+ *
+ * With -s whole shots are timed instead: frames from the test source
+ * in each palette, or from a recorded dump, go through the same
+ * decode, effects, banner and encode code as fswebcam itself.
+ *
+ * With -d the frame decoders are checked and timed, in every palette. */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <gd.h>
+#include "fswebcam.h"
+#include "log.h"
+#include "parse.h"
+#include "effects.h"
+#include "pool.h"
+#include "fbpool.h"
+#include "src.h"
+#include "dec.h"
+#include "enc.h"
+#include "stats.h"
+
+#define RGB(r, g, b) ((r << 16) + (g << 8) + b)
+
+#define R(c) ((c & 0xFF0000) >> 16)
+#define G(c) ((c & 0xFF00) >> 8)
+#define B(c) (c & 0xFF)
+
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+#define GREY(c) ((R(c) + G(c) + B(c)) / 3)
+#define MIX(a, b, c) (a + (((b - a) * c) / 0xFF))
+
+#define RGBMIX(c1, c2, d) \
+  (RGB(MIX(R(c1), R(c2), d), MIX(G(c1), G(c2), d), MIX(B(c1), G(c2), d)))
+
+typedef gdImage *(*bench_fx_t)(gdImage *src, char *options);
+
+typedef struct {
+	char *name;
+	char *options;
+	bench_fx_t ref;
+	bench_fx_t fx;
+} bench_effect_t;
+
+/* Reference effects. These are the original versions, using
+ * gdImageGetPixel, gdImageSetPixel and gdImageCopy. */
+
+static gdImage *ref_flip(gdImage *src, char *options)
+{
+	int i;
+	char d[32];
+	
+	i = 0;
+	while(!argncpy(d, 32, options, ", \t", i++, 0))
+	{
+		if(*d == 'v')
+		{
+			int y, h;
+			gdImage *line;
+			
+			line = gdImageCreateTrueColor(gdImageSX(src), 1);
+			h = gdImageSY(src) / 2;
+			
+			for(y = 0; y < h; y++)
+			{
+				/* Copy bottom line into buffer. */
+				gdImageCopy(line, src,
+				   0, 0,
+				   0, gdImageSY(src) - y - 1,
+				   gdImageSX(src), 1);
+				
+				/* Copy the top line onto the bottom. */
+				gdImageCopy(src, src,
+				   0, gdImageSY(src) - y - 1,
+				   0, y,
+				   gdImageSX(src), 1);
+				
+				/* Copy the buffer into the top. */
+				gdImageCopy(src, line,
+				   0, y,
+				   0, 0,
+				   gdImageSX(src), 1);
+			}
+			
+			gdImageDestroy(line);
+		}
+		else if(*d == 'h')
+		{
+			int x, w;
+			gdImage *line;
+			
+			line = gdImageCreateTrueColor(1, gdImageSY(src));
+			w = gdImageSX(src) / 2;
+			
+			for(x = 0; x < w; x++)
+			{
+				/* Copy right line into buffer. */
+				gdImageCopy(line, src,
+				   0, 0,
+				   gdImageSX(src) - x - 1, 0,
+				   1, gdImageSY(src));
+				
+				/* Copy the left line onto the right. */
+				gdImageCopy(src, src,
+				   gdImageSX(src) - x - 1, 0,
+				   x, 0,
+				   1, gdImageSY(src));
+				
+				/* Copy the buffer into the left. */
+				gdImageCopy(src, line,
+				   x, 0,
+				   0, 0,
+				   1, gdImageSY(src));
+			}
+			
+			gdImageDestroy(line);
+		}
+	}
+	
+	return(src);
+}
+
+static gdImage *ref_rotate(gdImage *src, char *options)
+{
+	int x, y;
+	gdImage *im;
+	int angle = atoi(options);
+	
+	if(angle == 180) im = gdImageCreateTrueColor(gdImageSX(src), gdImageSY(src));
+	else im = gdImageCreateTrueColor(gdImageSY(src), gdImageSX(src));
+	
+	for(y = 0; y < gdImageSY(src); y++)
+		for(x = 0; x < gdImageSX(src); x++)
+		{
+			int c = gdImageGetPixel(src, x, y);
+			
+			if(angle == 90)
+				gdImageSetPixel(im, gdImageSX(im) - y - 1, x, c);
+			else if(angle == 180)
+				gdImageSetPixel(im, gdImageSX(im) - x - 1,
+				                gdImageSY(im) - y - 1, c);
+			else
+				gdImageSetPixel(im, y, gdImageSY(im) - x - 1, c);
+		}
+	
+	gdImageDestroy(src);
+	
+	return(im);
+}
+
+static gdImage *ref_deinterlace(gdImage *src, char *options)
+{
+	int x, y;
+	
+	for(y = 1; y < gdImageSY(src) - 1; y += 2)
+		for(x = 0; x < gdImageSX(src); x++)
+		{
+			int c, cu, cd, d;
+			
+			c  = gdImageGetPixel(src, x, y);
+			cu = gdImageGetPixel(src, x, y - 1);
+			cd = gdImageGetPixel(src, x, y + 1);
+			
+			d = 0xFF - abs(GREY(cu) - GREY(cd));
+			d = (abs(GREY(cu) - (0xFF - GREY(c)) - GREY(cd)) * d) / 0xFF;
+			
+			c = RGBMIX(c, RGBMIX(cu, cd, 128), d);
+			
+			gdImageSetPixel(src, x, y, c);
+		}
+	
+	return(src);
+}
+
+static gdImage *ref_invert(gdImage *src, char *options)
+{
+	int x, y;
+	
+	for(y = 0; y < gdImageSY(src); y++)
+		for(x = 0; x < gdImageSX(src); x++)
+			gdImageSetPixel(src, x, y,
+			   0xFFFFFF - gdImageGetPixel(src, x, y));
+	
+	return(src);
+}
+
+static gdImage *ref_greyscale(gdImage *src, char *options)
+{
+	int x, y;
+	
+	for(y = 0; y < gdImageSY(src); y++)
+		for(x = 0; x < gdImageSX(src); x++)
+		{
+			uint8_t c = GREY(gdImageGetPixel(src, x, y));
+			gdImageSetPixel(src, x, y, RGB(c, c, c));
+		}
+	
+	return(src);
+}
+
+static gdImage *ref_swapchannels(gdImage *src, char *options)
+{
+	int x, y;
+	
+	for(y = 0; y < gdImageSY(src); y++)
+		for(x = 0; x < gdImageSX(src); x++)
+		{
+			int c = gdImageGetPixel(src, x, y);
+			
+			if(!strcmp(options, "RG")) c = RGB(G(c), R(c), B(c));
+			else if(!strcmp(options, "RB")) c = RGB(B(c), G(c), R(c));
+			else if(!strcmp(options, "GB")) c = RGB(R(c), B(c), G(c));
+			
+			gdImageSetPixel(src, x, y, c);
+		}
+	
+	return(src);
+}
+
+static bench_effect_t bench_effect[] = {
+	{ "flip",            "h", ref_flip,         fx_flip         },
+	{ "flip",            "v", ref_flip,         fx_flip         },
+	{ "flip",          "h,v", ref_flip,         fx_flip         },
+	{ "rotate",         "90", ref_rotate,       fx_rotate       },
+	{ "rotate",        "180", ref_rotate,       fx_rotate       },
+	{ "rotate",        "270", ref_rotate,       fx_rotate       },
+	{ "deinterlace",      "", ref_deinterlace,  fx_deinterlace  },
+	{ "invert",           "", ref_invert,       fx_invert       },
+	{ "greyscale",        "", ref_greyscale,    fx_greyscale    },
+	{ "swapchannels",   "RG", ref_swapchannels, fx_swapchannels },
+	{ "swapchannels",   "RB", ref_swapchannels, fx_swapchannels },
+	{ "swapchannels",   "GB", ref_swapchannels, fx_swapchannels },
+	{ NULL, NULL, NULL, NULL }
+};
+
+static double bench_now(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+/* A truecolor image filled with random opaque pixels. */
+static gdImage *bench_image(int w, int h, unsigned int seed)
+{
+	gdImage *im;
+	int x, y;
+	
+	im = gdImageCreateTrueColor(w, h);
+	if(!im) return(NULL);
+	
+	srand(seed);
+	for(y = 0; y < h; y++)
+		for(x = 0; x < w; x++)
+			im->tpixels[y][x] = rand() & 0xFFFFFF;
+	
+	return(im);
+}
+
+static int bench_compare(gdImage *a, gdImage *b)
+{
+	int y;
+	
+	if(gdImageSX(a) != gdImageSX(b)) return(-1);
+	if(gdImageSY(a) != gdImageSY(b)) return(-1);
+	
+	for(y = 0; y < gdImageSY(a); y++)
+		if(memcmp(a->tpixels[y], b->tpixels[y],
+		   gdImageSX(a) * sizeof(int))) return(-1);
+	
+	return(0);
+}
+
+/* Time one version of an effect, in nanoseconds per source pixel.
+ * The result of the last run is returned in out. */
+static double bench_run(bench_fx_t fx, char *options, int w, int h,
+                        int runs, gdImage **out)
+{
+	double t = 0;
+	int i;
+	
+	*out = NULL;
+	
+	for(i = 0; i < runs; i++)
+	{
+		gdImage *im = bench_image(w, h, 1);
+		double start;
+		
+		if(!im) return(-1);
+		if(*out) gdImageDestroy(*out);
+		
+		start = bench_now();
+		*out = fx(im, options);
+		t += bench_now() - start;
+	}
+	
+	return(t * 1e9 / runs / ((double) w * h));
+}
+
+static int bench_effects(int w, int h, int runs)
+{
+	bench_effect_t *e;
+	int failed = 0;
+	
+	printf("Effects at %ix%i, %i runs:\n\n", w, h, runs);
+	printf("%-20s %12s %12s %8s\n", "effect", "gd ns/px", "fx ns/px", "");
+	
+	for(e = bench_effect; e->name; e++)
+	{
+		gdImage *ref, *fx;
+		double tref, tfx;
+		char name[64];
+		int r;
+		
+		tref = bench_run(e->ref, e->options, w, h, runs, &ref);
+		tfx  = bench_run(e->fx,  e->options, w, h, runs, &fx);
+		
+		if(!ref || !fx)
+		{
+			fprintf(stderr, "Out of memory.\n");
+			return(-1);
+		}
+		
+		r = bench_compare(ref, fx);
+		if(r) failed++;
+		
+		snprintf(name, sizeof(name), "%s %s", e->name, e->options);
+		printf("%-20s %12.2f %12.2f %8s\n", name, tref, tfx,
+		       r ? "DIFFERS" : "ok");
+		
+		gdImageDestroy(ref);
+		gdImageDestroy(fx);
+	}
+	
+	printf("\n");
+	
+	return(failed);
+}
+
+/* The reference scaler is gd's own. The filters differ, so the output
+ * is compared by the largest difference in any channel. */
+static gdImage *ref_scale(gdImage *src, char *options)
+{
+	gdImage *im;
+	int w, h;
+	
+	w = argtol(options, "x ", 0, 0, 10);
+	h = argtol(options, "x ", 1, 0, 10);
+	
+	im = gdImageCreateTrueColor(w, h);
+	gdImageCopyResampled(im, src, 0, 0, 0, 0,
+	   w, h, gdImageSX(src), gdImageSY(src));
+	gdImageDestroy(src);
+	
+	return(im);
+}
+
+static int bench_maxdiff(gdImage *a, gdImage *b)
+{
+	int x, y, d = 0;
+	
+	if(gdImageSX(a) != gdImageSX(b)) return(-1);
+	if(gdImageSY(a) != gdImageSY(b)) return(-1);
+	
+	for(y = 0; y < gdImageSY(a); y++)
+		for(x = 0; x < gdImageSX(a); x++)
+		{
+			int ca = a->tpixels[y][x];
+			int cb = b->tpixels[y][x];
+			
+			d = MAX(d, abs(R(ca) - R(cb)));
+			d = MAX(d, abs(G(ca) - G(cb)));
+			d = MAX(d, abs(B(ca) - B(cb)));
+		}
+	
+	return(d);
+}
+
+static int bench_scale(int w, int h, int runs)
+{
+	/* After the fixed size, try 1/2, 1/4, 3/4, 1/24 and 1/40 of the
+	 * source. The small ones make box sum big blocks of pixels. */
+	int num[] = { 0, 1, 1, 3, 1, 1 };
+	int den[] = { 0, 2, 4, 4, 24, 40 };
+	char *filters[] = { "box", "bilinear", "lanczos", NULL };
+	int failed = 0;
+	int i, j;
+	
+	printf("Scaling from %ix%i, %i runs, %i threads:\n\n",
+	       w, h, runs, pool_threads());
+	printf("%-28s %12s %12s %8s\n", "scale", "gd ns/px", "fx ns/px",
+	       "maxdiff");
+	
+	for(i = 0; i < sizeof(den) / sizeof(den[0]); i++)
+	{
+		char size[32];
+		gdImage *ref;
+		double tref;
+		
+		if(!den[i]) snprintf(size, sizeof(size), "256x192");
+		else snprintf(size, sizeof(size), "%ix%i",
+		              w * num[i] / den[i], h * num[i] / den[i]);
+		
+		if(argtol(size, "x ", 0, 0, 10) < 1 ||
+		   argtol(size, "x ", 1, 0, 10) < 1) continue;
+		
+		tref = bench_run(ref_scale, size, w, h, runs, &ref);
+		if(!ref)
+		{
+			fprintf(stderr, "Out of memory.\n");
+			return(-1);
+		}
+		
+		for(j = 0; filters[j]; j++)
+		{
+			char options[64];
+			gdImage *fx;
+			double tfx;
+			int d;
+			
+			snprintf(options, sizeof(options), "%s,%s", size, filters[j]);
+			
+			tfx = bench_run(fx_scale, options, w, h, runs, &fx);
+			if(!fx)
+			{
+				fprintf(stderr, "Out of memory.\n");
+				return(-1);
+			}
+			
+			/* On the random test image only box scaling should
+			 * match gd, the rest is only reported. */
+			d = bench_maxdiff(ref, fx);
+			if(d < 0 || (j == 0 && d > 1)) failed++;
+			
+			printf("%-28s %12.2f %12.2f %8i\n", options, tref, tfx, d);
+			
+			gdImageDestroy(fx);
+		}
+		
+		gdImageDestroy(ref);
+	}
+	
+	printf("\n");
+	
+	return(failed);
+}
+
+/* Reference decoders. Each works out one pixel of a raw frame straight
+ * from the description of its format. The YUV formats use the integer
+ * maths fswebcam has always used, rather than an exact conversion. */
+typedef int (*bench_pixel_t)(src_t *src, int x, int y);
+
+static int ref_yuv(int y, int u, int v)
+{
+	int r, g, b;
+	
+	y <<= 8;
+	u -= 128;
+	v -= 128;
+	
+	r = (y + 359 * v) >> 8;
+	g = (y - 88 * u - 183 * v) >> 8;
+	b = (y + 454 * u) >> 8;
+	
+	return(RGB(CLIP(r, 0, 0xFF), CLIP(g, 0, 0xFF), CLIP(b, 0, 0xFF)));
+}
+
+static int ref_rgb32(src_t *src, int x, int y)
+{
+	uint8_t *p = (uint8_t *) src->img + (y * src->width + x) * 4;
+	return(RGB(p[0], p[1], p[2]));
+}
+
+static int ref_bgr32(src_t *src, int x, int y)
+{
+	uint8_t *p = (uint8_t *) src->img + (y * src->width + x) * 4;
+	return(RGB(p[2], p[1], p[0]));
+}
+
+static int ref_rgb24(src_t *src, int x, int y)
+{
+	uint8_t *p = (uint8_t *) src->img + (y * src->width + x) * 3;
+	return(RGB(p[0], p[1], p[2]));
+}
+
+static int ref_bgr24(src_t *src, int x, int y)
+{
+	uint8_t *p = (uint8_t *) src->img + (y * src->width + x) * 3;
+	return(RGB(p[2], p[1], p[0]));
+}
+
+/* 5 and 6 bit channels are scaled up by repeating their top bits. */
+static int ref_rgb565(src_t *src, int x, int y)
+{
+	int c = ((uint16_t *) src->img)[y * src->width + x];
+	int r = c >> 11, g = (c >> 5) & 0x3F, b = c & 0x1F;
+	
+	r = (r << 3) | (r >> 2);
+	g = (g << 2) | (g >> 4);
+	b = (b << 3) | (b >> 2);
+	
+	return(RGB(r, g, b));
+}
+
+static int ref_rgb555(src_t *src, int x, int y)
+{
+	int c = ((uint16_t *) src->img)[y * src->width + x];
+	int r = (c >> 10) & 0x1F, g = (c >> 5) & 0x1F, b = c & 0x1F;
+	
+	r = (r << 3) | (r >> 2);
+	g = (g << 3) | (g >> 2);
+	b = (b << 3) | (b >> 2);
+	
+	return(RGB(r, g, b));
+}
+
+static int ref_y16(src_t *src, int x, int y)
+{
+	int c = ((uint16_t *) src->img)[y * src->width + x] >> 8;
+	return(RGB(c, c, c));
+}
+
+static int ref_grey(src_t *src, int x, int y)
+{
+	int c = ((uint8_t *) src->img)[y * src->width + x];
+	return(RGB(c, c, c));
+}
+
+/* Each pair of pixels is stored as Y0 U Y1 V, or U Y0 V Y1. */
+static int ref_yuyv(src_t *src, int x, int y)
+{
+	uint8_t *p = (uint8_t *) src->img + (y * src->width + (x & ~1)) * 2;
+	
+	if(src->palette == SRC_PAL_UYVY)
+		return(ref_yuv(p[1 + (x & 1) * 2], p[0], p[2]));
+	
+	return(ref_yuv(p[(x & 1) * 2], p[1], p[3]));
+}
+
+/* A plane of Y, then planes of U and V at half the width and height. */
+static int ref_yuv420p(src_t *src, int x, int y)
+{
+	uint8_t *py = (uint8_t *) src->img;
+	uint8_t *pu = py + src->width * src->height;
+	uint8_t *pv = pu + src->width * src->height / 4;
+	int c = (y / 2) * (src->width / 2) + x / 2;
+	
+	return(ref_yuv(py[y * src->width + x], pu[c], pv[c]));
+}
+
+/* A plane of Y, then one of interleaved U and V at half the height,
+ * both stored as 16x16 tiles in rows of tiles. */
+static int ref_nv12mb(src_t *src, int x, int y)
+{
+	uint8_t *py = (uint8_t *) src->img;
+	uint8_t *puv = py + src->width * src->height;
+	int tiles = src->width / 16;
+	int cy = y / 2, cx = x & ~1;
+	int l, c;
+	
+	l = ((y / 16) * tiles + x / 16) * 256 + (y % 16) * 16 + x % 16;
+	c = ((cy / 16) * tiles + cx / 16) * 256 + (cy % 16) * 16 + cx % 16;
+	
+	return(ref_yuv(py[l], puv[c], puv[c + 1]));
+}
+
+/* Which colour each bayer pixel holds, 0 = red, 1 = green, 2 = blue. */
+static int ref_bayer_colour(int palette, int x, int y)
+{
+	static const int pattern[3][4] = {
+		{ 2, 1, 1, 0 }, /* SBGGR8 */
+		{ 1, 2, 0, 1 }, /* SGBRG8 */
+		{ 1, 0, 2, 1 }, /* SGRBG8 */
+	};
+	int i = (palette == SRC_PAL_BAYER ? 0 : palette == SRC_PAL_SGBRG8 ? 1 : 2);
+	
+	return(pattern[i][(y & 1) * 2 + (x & 1)]);
+}
+
+/* Pixels off the edge are taken from the other side. */
+static int ref_bayer_at(src_t *src, int x, int y)
+{
+	if(x < 0) x = 1;
+	else if(x >= src->width) x = src->width - 2;
+	if(y < 0) y = 1;
+	else if(y >= src->height) y = src->height - 2;
+	
+	return(((uint8_t *) src->img)[y * src->width + x]);
+}
+
+/* Bilinear: the missing colours are the average of the neighbours
+ * that hold them. Green at a red or blue pixel averages the pair
+ * across and the pair up and down. */
+static int ref_bayer(src_t *src, int x, int y)
+{
+	int c[3], hn, vn, di, own;
+	
+	own = ref_bayer_colour(src->palette, x, y);
+	
+	hn = (ref_bayer_at(src, x - 1, y) + ref_bayer_at(src, x + 1, y)) / 2;
+	vn = (ref_bayer_at(src, x, y - 1) + ref_bayer_at(src, x, y + 1)) / 2;
+	di = (ref_bayer_at(src, x - 1, y - 1) + ref_bayer_at(src, x + 1, y - 1) +
+	      ref_bayer_at(src, x - 1, y + 1) + ref_bayer_at(src, x + 1, y + 1)) / 4;
+	
+	c[own] = ref_bayer_at(src, x, y);
+	
+	if(own == 1)
+	{
+		c[ref_bayer_colour(src->palette, x + 1, y)] = hn;
+		c[ref_bayer_colour(src->palette, x, y + 1)] = vn;
+	}
+	else
+	{
+		c[1] = (hn + vn) / 2;
+		c[2 - own] = di;
+	}
+	
+	return(RGB(c[0], c[1], c[2]));
+}
+
+typedef struct {
+	int palette;
+	int bpp; /* Bits per pixel, 0 if compressed */
+	bench_pixel_t ref;
+} bench_decoder_t;
+
+static bench_decoder_t bench_decoder[] = {
+	{ SRC_PAL_RGB32,   32, ref_rgb32   },
+	{ SRC_PAL_BGR32,   32, ref_bgr32   },
+	{ SRC_PAL_RGB24,   24, ref_rgb24   },
+	{ SRC_PAL_BGR24,   24, ref_bgr24   },
+	{ SRC_PAL_RGB565,  16, ref_rgb565  },
+	{ SRC_PAL_RGB555,  16, ref_rgb555  },
+	{ SRC_PAL_YUYV,    16, ref_yuyv    },
+	{ SRC_PAL_UYVY,    16, ref_yuyv    },
+	{ SRC_PAL_YUV420P, 12, ref_yuv420p },
+	{ SRC_PAL_NV12MB,  12, ref_nv12mb  },
+	{ SRC_PAL_BAYER,    8, ref_bayer   },
+	{ SRC_PAL_SGBRG8,   8, ref_bayer   },
+	{ SRC_PAL_SGRBG8,   8, ref_bayer   },
+	{ SRC_PAL_GREY,     8, ref_grey    },
+	{ SRC_PAL_Y16,     16, ref_y16     },
+	{ SRC_PAL_S561,     0, NULL        },
+	{ SRC_PAL_JPEG,     0, NULL        },
+	{ SRC_PAL_MJPEG,    0, NULL        },
+	{ SRC_PAL_PNG,      0, NULL        },
+	{ -1, 0, NULL }
+};
+
+/* Time stamp counter cycles, where there is one. These tick at a fixed
+ * rate, which may not be the clock rate of the core. */
+static uint64_t bench_cycles(void)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	return(__builtin_ia32_rdtsc());
+#else
+	return(0);
+#endif
+}
+
+/* Cameras sending MJPEG leave out the Huffman tables. */
+static void bench_strip_dht(src_t *src)
+{
+	uint8_t *p = src->img, *end = p + src->length;
+	
+	for(p += 2; p + 4 <= end && p[0] == 0xFF && p[1] != 0xDA; )
+	{
+		uint32_t l = 2 + (p[2] << 8) + p[3];
+		
+		if(p[1] != 0xC4)
+		{
+			p += l;
+			continue;
+		}
+		
+		memmove(p, p + l, end - p - l);
+		src->length -= l;
+		end -= l;
+	}
+}
+
+/* A compressed frame of an image with some detail. */
+static int bench_compressed_frame(src_t *src)
+{
+	fswc_jpeg_opts_t opts;
+	unsigned long len, size = 0;
+	uint8_t *buf = NULL;
+	gdImage *im;
+	int x, y, l;
+	
+	im = gdImageCreateTrueColor(src->width, src->height);
+	if(!im) return(-1);
+	
+	for(y = 0; y < src->height; y++)
+		for(x = 0; x < src->width; x++)
+			im->tpixels[y][x] = RGB((x * 255 / src->width),
+			   (y * 255 / src->height), ((x ^ y) & 0xFF));
+	
+	if(src->palette == SRC_PAL_PNG)
+	{
+		void *png = gdImagePngPtr(im, &l);
+		
+		if(png && (buf = malloc(l))) memcpy(buf, png, l);
+		if(png) gdFree(png);
+		len = l;
+	}
+	else
+	{
+		fswc_jpeg_defaults(&opts);
+		opts.quality = 90;
+		
+		if(fswc_encode_jpeg_mem(im, &opts, &buf, &len, &size))
+		{
+			free(buf);
+			buf = NULL;
+		}
+	}
+	
+	gdImageDestroy(im);
+	
+	if(!buf) return(-1);
+	
+	src->img    = buf;
+	src->length = len;
+	
+	if(src->palette == SRC_PAL_MJPEG) bench_strip_dht(src);
+	
+	return(0);
+}
+
+/* A frame of random data, or for the compressed palettes a real one.
+ * Not every bit string is valid spca561 data, a random mix of the
+ * bytes 0x55 and 0xAA is. It uses a variable number of bits per pixel,
+ * so it's given plenty. */
+static int bench_frame(src_t *src, bench_decoder_t *d, int w, int h)
+{
+	uint32_t i;
+	
+	memset(src, 0, sizeof(src_t));
+	src->palette = d->palette;
+	src->width   = w;
+	src->height  = h;
+	
+	if(d->palette == SRC_PAL_JPEG || d->palette == SRC_PAL_MJPEG ||
+	   d->palette == SRC_PAL_PNG) return(bench_compressed_frame(src));
+	
+	if(d->palette == SRC_PAL_S561) src->length = w * h * 4;
+	else src->length = (uint64_t) w * h * d->bpp / 8;
+	
+	src->img = malloc(src->length);
+	if(!src->img) return(-1);
+	
+	srand(d->palette);
+	for(i = 0; i < src->length; i++)
+	{
+		uint8_t c = rand();
+		
+		if(d->palette == SRC_PAL_S561) c = (c & 1 ? 0x55 : 0xAA);
+		((uint8_t *) src->img)[i] = c;
+	}
+	
+	return(0);
+}
+
+/* What the frame should decode to. */
+static gdImage *bench_ref_image(src_t *src, bench_decoder_t *d)
+{
+	gdImage *im;
+	src_t bayer;
+	int x, y;
+	
+	switch(d->palette)
+	{
+	case SRC_PAL_JPEG:
+		return(gdImageCreateFromJpegPtr(src->length, src->img));
+	case SRC_PAL_MJPEG:
+	{
+		uint8_t *jpeg;
+		uint32_t l;
+		
+		if(verify_jpeg_dht(src->img, src->length, &jpeg, &l) < 0)
+			return(NULL);
+		
+		im = gdImageCreateFromJpegPtr(l, jpeg);
+		if(jpeg != src->img) free(jpeg);
+		
+		return(im);
+	}
+	case SRC_PAL_PNG:
+		return(gdImageCreateFromPngPtr(src->length, src->img));
+	}
+	
+	im = gdImageCreateTrueColor(src->width, src->height);
+	if(!im) return(NULL);
+	
+	/* Only the bayer stage of S561 is checked, against the output of
+	 * its own decompressor. */
+	bayer = *src;
+	if(d->palette == SRC_PAL_S561)
+	{
+		bayer.palette = SRC_PAL_SGBRG8;
+		bayer.img = malloc(src->width * src->height);
+		
+		if(!bayer.img || fswc_decode_s561(src, bayer.img))
+		{
+			free(bayer.img);
+			gdImageDestroy(im);
+			return(NULL);
+		}
+	}
+	
+	for(y = 0; y < src->height; y++)
+		for(x = 0; x < src->width; x++)
+			im->tpixels[y][x] = (d->ref ? d->ref : ref_bayer)(&bayer, x, y);
+	
+	if(bayer.img != src->img) free(bayer.img);
+	
+	return(im);
+}
+
+/* Compare im against the area of ref starting at x0,y0. */
+static int bench_compare_area(gdImage *ref, gdImage *im, int x0, int y0)
+{
+	int y;
+	
+	if(x0 + gdImageSX(im) > gdImageSX(ref)) return(-1);
+	if(y0 + gdImageSY(im) > gdImageSY(ref)) return(-1);
+	
+	for(y = 0; y < gdImageSY(im); y++)
+		if(memcmp(ref->tpixels[y0 + y] + x0, im->tpixels[y],
+		   gdImageSX(im) * sizeof(int))) return(-1);
+	
+	return(0);
+}
+
+/* Check the full frame, a crop from an odd offset and the sum used
+ * when stacking frames. Returns a description of the first that
+ * differs, or NULL. */
+static char *bench_check_decoder(src_t *src, gdImage *ref)
+{
+	fswc_hint_t hint;
+	avgbmp_t *abitmap;
+	char crop[64];
+	gdImage *im;
+	size_t i, n;
+	int r;
+	
+	im = fswc_decode_image(src, NULL);
+	if(!im) return("decode failed");
+	r = bench_compare(ref, im);
+	fbpool_release(im);
+	if(r) return("DIFFERS");
+	
+	/* Decoders that can't crop leave it to fx_crop. */
+	memset(&hint, 0, sizeof(hint));
+	snprintf(crop, sizeof(crop), "%ix%i,%ix%i", src->width / 2,
+	         src->height / 2, (src->width / 4) | 1, (src->height / 4) | 1);
+	hint.crop = crop;
+	
+	im = fswc_decode_image(src, &hint);
+	if(!im) return("crop failed");
+	r = bench_compare_area(ref, im, hint.cropped ? (src->width / 4) | 1 : 0,
+	                       hint.cropped ? (src->height / 4) | 1 : 0);
+	fbpool_release(im);
+	if(r) return("crop DIFFERS");
+	
+	n = (size_t) src->width * src->height * 3;
+	abitmap = calloc(n, sizeof(avgbmp_t));
+	if(!abitmap) return("out of memory");
+	
+	r = fswc_add_image(src, abitmap, NULL);
+	for(i = 0; !r && i < n; i += 3)
+	{
+		int c = ref->tpixels[i / 3 / src->width][i / 3 % src->width];
+		
+		if(abitmap[i] != R(c) || abitmap[i + 1] != G(c) ||
+		   abitmap[i + 2] != B(c)) r = -1;
+	}
+	
+	free(abitmap);
+	
+	return(r ? "stack DIFFERS" : NULL);
+}
+
+static void bench_decoder_row(char *name, src_t *src, double t,
+                              uint64_t cycles, int runs, char *result)
+{
+	double pixels = (double) src->width * src->height * runs;
+	char cpp[32] = "-";
+	
+	if(cycles) snprintf(cpp, sizeof(cpp), "%.2f", cycles / pixels);
+	
+	printf("%-12s %5ix%-5i %10.1f %10.1f %10s  %s\n", name, src->width,
+	       src->height, src->length * (double) runs / t / 1e6,
+	       pixels / t / 1e6, cpp, result ? result : "ok");
+}
+
+/* Time each YUYV kernel this CPU has against the plain C one. */
+static int bench_yuyv_kernels(src_t *src, int runs)
+{
+	fswc_yuyv_kernel_t *k;
+	int *ref, *row;
+	int failed = 0;
+	
+	ref = malloc(src->width * sizeof(int));
+	row = malloc(src->width * sizeof(int));
+	if(!ref || !row)
+	{
+		free(ref);
+		free(row);
+		return(-1);
+	}
+	
+	for(k = fswc_yuyv_kernel; k->name; k++)
+	{
+		char name[32];
+		char *result = NULL;
+		uint64_t cycles;
+		double start, t;
+		int i, y, uyvy;
+		
+		if(k->supported && !k->supported()) continue;
+		
+		/* Every width up to a few times the widest kernel, so each
+		 * tail is checked, then whole rows. */
+		for(uyvy = 0; uyvy < 2; uyvy++)
+			for(i = 1; i <= src->width; i++)
+			{
+				uint32_t w = (i <= 64 ? i : src->width);
+				
+				fswc_yuyv_row_c(src->img, ref, w, uyvy);
+				memset(row, 0, w * sizeof(int));
+				k->row(src->img, row, w, uyvy);
+				
+				if(memcmp(ref, row, w * sizeof(int))) result = "DIFFERS";
+				if(i > 64) break;
+			}
+		
+		start  = bench_now();
+		cycles = bench_cycles();
+		for(i = 0; i < runs; i++)
+			for(y = 0; y < src->height; y++)
+				k->row((uint8_t *) src->img + y * src->width * 2, row,
+				       src->width, 0);
+		cycles = bench_cycles() - cycles;
+		t = bench_now() - start;
+		
+		snprintf(name, sizeof(name), "  yuyv/%s", k->name);
+		bench_decoder_row(name, src, t, cycles, runs, result);
+		
+		if(result) failed++;
+	}
+	
+	free(ref);
+	free(row);
+	
+	return(failed);
+}
+
+/* The nearest size to w x h that a frame in the palette can have. */
+static void bench_palette_size(int palette, int *w, int *h)
+{
+	switch(palette)
+	{
+	case SRC_PAL_YUV420P:
+		*w &= ~1;
+		*h &= ~1;
+		break;
+	case SRC_PAL_NV12MB:
+		*w = (*w < 16 ? 16 : *w & ~0xF);
+		*h = (*h < 32 ? 32 : *h & ~0x1F);
+		break;
+	case SRC_PAL_S561:
+		if(*w > 640) *w = 640;
+		if(*h > 480) *h = 480;
+		break;
+	}
+}
+
+static int bench_decoders(int w, int h, int runs)
+{
+	bench_decoder_t *d;
+	int failed = 0;
+	
+	printf("Decoders at %ix%i, %i runs, %i threads:\n\n", w, h, runs,
+	       pool_threads());
+	printf("%-12s %11s %10s %10s %10s\n", "palette", "size", "MB/s",
+	       "MPix/s", "cycles/px");
+	
+	for(d = bench_decoder; d->palette != -1; d++)
+	{
+		char *result;
+		uint64_t cycles;
+		double start, t;
+		gdImage *ref;
+		src_t src;
+		int fw = w, fh = h;
+		int i;
+		
+		bench_palette_size(d->palette, &fw, &fh);
+		
+		if(fw < 2 || fh < 2 || bench_frame(&src, d, fw, fh))
+		{
+			printf("%-12s %5ix%-5i  unable to create a frame\n",
+			       src_palette[d->palette].name, fw, fh);
+			failed++;
+			continue;
+		}
+		
+		ref = bench_ref_image(&src, d);
+		if(!ref) result = "no reference";
+		else result = bench_check_decoder(&src, ref);
+		
+		start  = bench_now();
+		cycles = bench_cycles();
+		for(i = 0; i < runs; i++)
+		{
+			gdImage *im = fswc_decode_image(&src, NULL);
+			if(im) fbpool_release(im);
+		}
+		cycles = bench_cycles() - cycles;
+		t = bench_now() - start;
+		
+		bench_decoder_row(src_palette[d->palette].name, &src, t, cycles,
+		                  runs, result);
+		if(result) failed++;
+		
+		if(d->palette == SRC_PAL_YUYV && bench_yuyv_kernels(&src, runs))
+			failed++;
+		
+		if(ref) gdImageDestroy(ref);
+		free(src.img);
+	}
+	
+	fbpool_free();
+	printf("\n");
+	
+	return(failed);
+}
+
+/* Runs one set of shots with the fswebcam options in argv. */
+static int bench_shots_run(char *name, int argc, char *argv[], int w, int h,
+                           int runs, int verbose)
+{
+	fswebcam_config_t *config;
+	double start, t;
+	int taken;
+	
+	/* Errors are logged to stderr, keep them in order. */
+	fflush(stdout);
+	
+	taken = 0;
+	config = fswc_config_new(argc, argv);
+	if(config)
+	{
+		stats_reset();
+		
+		start = bench_now();
+		taken = fswc_bench_shots(config, runs);
+		t = bench_now() - start;
+		
+		fswc_config_free(config);
+		fbpool_free();
+	}
+	
+	if(taken < 1)
+	{
+		printf("%-10s %5ix%-5i %8s\n", name, w, h, "FAILED");
+		return(-1);
+	}
+	
+	printf("%-10s %5ix%-5i %8i %10.2f %10.2f\n", name, w, h, taken,
+	       taken / t, (double) taken * w * h / t / 1e6);
+	
+	/* The stage timings are logged, send them to stdout. */
+	if(verbose)
+	{
+		fflush(stdout);
+		log_set_fd(STDOUT_FILENO);
+		log_quiet(0);
+		stats_report(NULL);
+		log_quiet(1);
+		printf("\n");
+	}
+	
+	return(0);
+}
+
+/* Shots from the test source in one palette. The size is rounded to
+ * one the palette can hold, args holds pointers to size and pal. */
+static int bench_shots_palette(char *name, int argc, char *argv[],
+                               char *size, char *pal, int w, int h,
+                               int runs, int verbose)
+{
+	int i;
+	
+	for(i = 0; src_palette[i].name; i++)
+		if(!strcasecmp(src_palette[i].name, name))
+			bench_palette_size(i, &w, &h);
+	
+	snprintf(size, 32, "%ix%i", w, h);
+	snprintf(pal, 32, "%s", name);
+	
+	return(bench_shots_run(name, argc, argv, w, h, runs, verbose));
+}
+
+/* Times whole shots from the test source in each palette listed in
+ * palettes, or every palette it can produce. If the fswebcam options
+ * name a device its frames are replayed instead. */
+static int bench_shots(int w, int h, int runs, int verbose, char *palettes,
+                       int argc, char *argv[])
+{
+	char *args[argc + 8];
+	char size[32], pal[32];
+	struct rusage ru;
+	int i, n, device = 0;
+	int failed = 0;
+	
+	snprintf(size, sizeof(size), "%ix%i", w, h);
+	snprintf(pal, sizeof(pal), "%s", palettes ? palettes : "");
+	
+	for(i = 0; i < argc; i++)
+		if(!strcmp(argv[i], "-d") || !strncmp(argv[i], "--device", 8))
+			device = 1;
+	
+	/* The user's options come last so they win. */
+	n = 0;
+	args[n++] = "fswebcam-bench";
+	if(!device)
+	{
+		args[n++] = "-d";
+		args[n++] = "test";
+	}
+	args[n++] = "-r";
+	args[n++] = size;
+	if(!device || palettes)
+	{
+		args[n++] = "-p";
+		args[n++] = pal;
+	}
+	for(i = 0; i < argc; i++) args[n++] = argv[i];
+	args[n] = NULL;
+	
+	printf("Shots at %s, %i runs, %i threads:\n\n", size, runs,
+	       pool_threads());
+	printf("%-10s %11s %8s %10s %10s\n", "palette", "size", "shots",
+	       "shots/s", "MPix/s");
+	
+	if(device)
+	{
+		if(bench_shots_run("replay", n, args, w, h, runs, verbose))
+			failed++;
+	}
+	else if(palettes)
+	{
+		char name[32];
+		
+		i = 0;
+		while(!argncpy(name, sizeof(name), palettes, ", \t", i++, 0))
+			if(bench_shots_palette(name, n, args, size, pal, w, h,
+			                       runs, verbose)) failed++;
+	}
+	else
+	{
+		/* The test source can't produce S561. */
+		for(i = 0; src_palette[i].name; i++)
+		{
+			if(i == SRC_PAL_S561) continue;
+			
+			if(bench_shots_palette(src_palette[i].name, n, args, size,
+			                       pal, w, h, runs, verbose)) failed++;
+		}
+	}
+	
+	getrusage(RUSAGE_SELF, &ru);
+	printf("\nPeak RSS: %li KiB\n\n", (long) ru.ru_maxrss);
+	
+	return(failed);
+}
+
+static int bench_usage(void)
+{
+	printf("Usage: fswebcam-bench [<options>] [-- <fswebcam options>]\n"
+	       "\n"
+	       " -r <size>      Sets the image size. (Default 1920x1080)\n"
+	       " -n <number>    Sets the number of runs. (Default 10)\n"
+	       " -t <number>    Sets the number of threads. (Default 1)\n"
+	       " -d             Check and time the frame decoders.\n"
+	       " -s             Time whole shots instead of single effects.\n"
+	       " -p <palettes>  Palettes to time shots in, eg. yuyv,mjpeg. (Default all)\n"
+	       " -v             Show the time taken by each stage of a shot.\n"
+	       " -- <options>   Passes the options to fswebcam when timing shots,\n"
+	       "                eg. -- --no-banner, or -- -d raw:dump.yuyv -p yuyv\n"
+	       " -h             Display this help page and exit.\n"
+	       "\n");
+	
+	return(0);
+}
+
+int main(int argc, char *argv[])
+{
+	int w = 1920, h = 1080, runs = 10, threads = 1;
+	int decoders = 0, shots = 0, verbose = 0;
+	char *palettes = NULL;
+	int c, failed;
+	
+	while((c = getopt(argc, argv, "r:n:t:dsp:vh")) != -1)
+	{
+		switch(c)
+		{
+		case 'r':
+			w = argtol(optarg, "x ", 0, 0, 10);
+			h = argtol(optarg, "x ", 1, 0, 10);
+			break;
+		case 'n':
+			runs = atoi(optarg);
+			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
+		case 'd':
+			decoders = 1;
+			break;
+		case 's':
+			shots = 1;
+			break;
+		case 'p':
+			palettes = optarg;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			bench_usage();
+			return(c == 'h' ? 0 : -1);
+		}
+	}
+	
+	if(w < 1 || h < 1 || runs < 1 || threads < 0)
+	{
+		fprintf(stderr, "Invalid resolution, number of runs or threads.\n");
+		return(-1);
+	}
+	
+	/* The effects report what they're doing, keep it quiet. */
+	log_quiet(1);
+	
+	pool_init(threads);
+	
+	if(decoders) failed = bench_decoders(w, h, runs);
+	else if(shots)
+	{
+		/* The banner font is found with fontconfig, as fswebcam does. */
+		gdFTUseFontConfig(1);
+		
+		failed = bench_shots(w, h, runs, verbose, palettes,
+		                     argc - optind, argv + optind);
+	}
+	else
+	{
+		failed  = bench_effects(w, h, runs);
+		failed |= bench_scale(w, h, runs);
+	}
+	
+	pool_free();
+	
+	return(failed ? 1 : 0);
+}
+
@@ -0,0 +1,294 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2011 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <gd.h>
+#include "fswebcam.h"
+#include "src.h"
+#include "dec.h"
+#include "log.h"
+#include "pool.h"
+#include "fbpool.h"
+#include "effects.h"
+
+typedef struct {
+	int palette;
+	uint8_t bpp;      /* Bits per pixel in the raw frame */
+	fswc_line_t line;
+} fswc_decoder_t;
+
+static fswc_decoder_t fswc_decoder[] = {
+	{ SRC_PAL_RGB32,   32, fswc_line_rgb32   },
+	{ SRC_PAL_BGR32,   32, fswc_line_bgr32   },
+	{ SRC_PAL_RGB24,   24, fswc_line_rgb24   },
+	{ SRC_PAL_BGR24,   24, fswc_line_bgr24   },
+	{ SRC_PAL_BAYER,    8, fswc_line_bayer   },
+	{ SRC_PAL_SGBRG8,   8, fswc_line_bayer   },
+	{ SRC_PAL_SGRBG8,   8, fswc_line_bayer   },
+	{ SRC_PAL_YUYV,    16, fswc_line_yuyv    },
+	{ SRC_PAL_UYVY,    16, fswc_line_yuyv    },
+	{ SRC_PAL_YUV420P, 12, fswc_line_yuv420p },
+	{ SRC_PAL_NV12MB,  12, fswc_line_nv12mb  },
+	{ SRC_PAL_RGB565,  16, fswc_line_rgb565  },
+	{ SRC_PAL_RGB555,  16, fswc_line_rgb555  },
+	{ SRC_PAL_Y16,     16, fswc_line_y16     },
+	{ SRC_PAL_GREY,     8, fswc_line_grey    },
+	{ -1, 0, NULL }
+};
+
+fswc_line_t fswc_find_line(src_t *src)
+{
+	fswc_decoder_t *d;
+	
+	for(d = fswc_decoder; d->line; d++)
+	{
+		if(d->palette != src->palette) continue;
+		
+		/* Don't read past the end of a short frame. */
+		if(src->length < (uint64_t) src->width * src->height * d->bpp / 8)
+		{
+			WARN("Frame is too short: %u bytes.", src->length);
+			return(NULL);
+		}
+		
+		return(d->line);
+	}
+	
+	return(NULL);
+}
+
+/* SPCA561 frames are decompressed to a bayer image first. On
+ * success bayer->img must be freed by the caller. */
+static int fswc_s561_to_bayer(src_t *src, src_t *bayer)
+{
+	*bayer = *src;
+	bayer->palette = SRC_PAL_SGBRG8;
+	bayer->length  = src->width * src->height;
+	bayer->img     = malloc(bayer->length);
+	
+	if(!bayer->img)
+	{
+		ERROR("Out of memory.");
+		return(-1);
+	}
+	
+	if(fswc_decode_s561(src, bayer->img))
+	{
+		free(bayer->img);
+		return(-1);
+	}
+	
+	return(0);
+}
+
+/* Crop while decoding, if the hint asks for it and the area lies
+ * within the width x height frame. Returns 1 if the area is set. */
+int fswc_hint_crop(fswc_hint_t *hint, uint32_t width, uint32_t height,
+                   uint32_t *x, uint32_t *y, uint32_t *w, uint32_t *h)
+{
+	int cx, cy, cw, ch;
+	
+	if(!hint || !hint->crop) return(0);
+	
+	/* Anything unusual is left for fx_crop to handle or report. */
+	if(fx_crop_area(width, height, hint->crop, &cx, &cy, &cw, &ch))
+		return(0);
+	if(cw < 1 || ch < 1) return(0);
+	if(cx + cw > width || cy + ch > height) return(0);
+	
+	MSG("Cropping image from %ix%i [offset: %ix%i] -> %ix%i.",
+	    width, height, cx, cy, cw, ch);
+	
+	*x = cx;
+	*y = cy;
+	*w = cw;
+	*h = ch;
+	
+	return(1);
+}
+
+/* An area of a frame being split into horizontal bands for the
+ * thread pool. */
+typedef struct {
+	src_t *src;
+	fswc_line_t line;
+	uint32_t x, y;
+	uint32_t width, height;
+	gdImage *im;
+	avgbmp_t *abitmap;
+	int bands;
+	volatile int error;
+} fswc_bands_t;
+
+static void fswc_bands(fswc_bands_t *b)
+{
+	b->bands = pool_threads();
+	if(b->bands > b->height) b->bands = b->height;
+}
+
+static void fswc_band_rows(fswc_bands_t *b, int part, uint32_t *y0, uint32_t *y1)
+{
+	*y0 = (uint64_t) b->height * part / b->bands;
+	*y1 = (uint64_t) b->height * (part + 1) / b->bands;
+}
+
+/* Bands can be decoded independently, as the line decoders (bayer
+ * included) read any neighbouring lines straight from the frame. */
+static void fswc_decode_band(void *arg, int part)
+{
+	fswc_bands_t *b = (fswc_bands_t *) arg;
+	uint32_t y, y0, y1;
+	
+	fswc_band_rows(b, part, &y0, &y1);
+	for(y = y0; y < y1; y++)
+		b->line(b->src, b->y + y, b->x, b->width, b->im->tpixels[y]);
+}
+
+/* Decode the frame into a truecolor image, or NULL on error. Raw
+ * palettes are converted straight into the rows of the image, only
+ * converting the cropped area if the hint has one. The hint may be
+ * NULL. */
+gdImage *fswc_decode_image(src_t *src, fswc_hint_t *hint)
+{
+	fswc_bands_t b;
+	gdImage *im;
+	src_t bayer;
+	
+	switch(src->palette)
+	{
+	case SRC_PAL_PNG:
+		return(fswc_decode_png(src));
+	case SRC_PAL_JPEG:
+	case SRC_PAL_MJPEG:
+		return(fswc_decode_jpeg(src, hint));
+	case SRC_PAL_S561:
+		if(fswc_s561_to_bayer(src, &bayer)) return(NULL);
+		im = fswc_decode_image(&bayer, hint);
+		free(bayer.img);
+		return(im);
+	}
+	
+	memset(&b, 0, sizeof(b));
+	b.src  = src;
+	b.line = fswc_find_line(src);
+	if(!b.line) return(NULL);
+	
+	b.width  = src->width;
+	b.height = src->height;
+	
+	if(fswc_hint_crop(hint, src->width, src->height,
+	                  &b.x, &b.y, &b.width, &b.height))
+		hint->cropped = 1;
+	
+	b.im = fbpool_image(b.width, b.height);
+	if(!b.im)
+	{
+		ERROR("Out of memory.");
+		return(NULL);
+	}
+	
+	fswc_bands(&b);
+	pool_run(b.bands, fswc_decode_band, &b);
+	
+	return(b.im);
+}
+
+static void fswc_add_band(void *arg, int part)
+{
+	fswc_bands_t *b = (fswc_bands_t *) arg;
+	src_t *src = b->src;
+	avgbmp_t *abitmap;
+	uint32_t x, y, y0, y1;
+	int *row;
+	
+	row = malloc(src->width * sizeof(int));
+	if(!row)
+	{
+		b->error = 1;
+		return;
+	}
+	
+	fswc_band_rows(b, part, &y0, &y1);
+	abitmap = b->abitmap + (size_t) y0 * src->width * 3;
+	
+	for(y = y0; y < y1; y++)
+	{
+		if(b->line) b->line(src, y, 0, src->width, row);
+		else
+		{
+			/* Compressed frames may not match the expected size. */
+			for(x = 0; x < src->width; x++)
+			{
+				if(x < gdImageSX(b->im) && y < gdImageSY(b->im))
+					row[x] = gdImageTrueColorPixel(b->im, x, y);
+				else row[x] = 0;
+			}
+		}
+		
+		for(x = 0; x < src->width; x++)
+		{
+			*(abitmap++) += (row[x] >> 16) & 0xFF;
+			*(abitmap++) += (row[x] >> 8) & 0xFF;
+			*(abitmap++) += row[x] & 0xFF;
+		}
+	}
+	
+	free(row);
+}
+
+/* Add the frame to the average bitmap, for stacking frames. Only
+ * hint->fast is used, the frame is always added at full size. */
+int fswc_add_image(src_t *src, avgbmp_t *abitmap, fswc_hint_t *hint)
+{
+	fswc_bands_t b;
+	
+	/* JPEG frames are decoded straight into the bitmap. */
+	if(src->palette == SRC_PAL_JPEG || src->palette == SRC_PAL_MJPEG)
+		return(fswc_add_jpeg(src, abitmap, hint));
+	
+	memset(&b, 0, sizeof(b));
+	b.src     = src;
+	b.width   = src->width;
+	b.height  = src->height;
+	b.abitmap = abitmap;
+	
+	switch(src->palette)
+	{
+	case SRC_PAL_PNG:
+	case SRC_PAL_S561:
+		b.im = fswc_decode_image(src, NULL);
+		if(!b.im) return(-1);
+		break;
+	
+	default:
+		b.line = fswc_find_line(src);
+		if(!b.line) return(-1);
+		break;
+	}
+	
+	fswc_bands(&b);
+	pool_run(b.bands, fswc_add_band, &b);
+	
+	if(b.im) fbpool_release(b.im);
+	
+	if(b.error)
+	{
+		ERROR("Out of memory.");
+		return(-1);
+	}
+	
+	return(0);
+}
+
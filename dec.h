@@ -14,27 +14,77 @@
 #include "config.h"
 #endif
 
-extern int fswc_add_image_bayer(avgbmp_t *dst, uint8_t *img, uint32_t length, uint32_t w, uint32_t h, int palette);
+#include <stdio.h>
+#include <gd.h>
 
-extern int fswc_add_image_y16(src_t *src, avgbmp_t *abitmap);
-extern int fswc_add_image_grey(src_t *src, avgbmp_t *abitmap);
+/* Line decoders convert w pixels of row y of a raw frame, starting
+ * at column x0, into packed truecolor pixels. This is the same format
+ * as the rows of gdImage->tpixels. */
+typedef void (*fswc_line_t)(src_t *src, uint32_t y, uint32_t x0, uint32_t w, int *dst);
 
-extern int fswc_add_image_jpeg(src_t *src, avgbmp_t *abitmap);
+/* What the jobs after decoding need from the frame. Decoders that
+ * can scale cheaply (JPEG) may return any size between width x height
+ * and the full frame. A size of zero asks for the full frame.
+ * 
+ * If crop is set, it holds the options of a --crop job that can be
+ * done while decoding. The decoder sets cropped if it did so.
+ * 
+ * fast allows a less accurate but faster JPEG decode. */
+typedef struct {
+	uint32_t width;
+	uint32_t height;
+	
+	char *crop;
+	int cropped;
+	
+	int fast;
+} fswc_hint_t;
 
-extern int fswc_add_image_png(src_t *src, avgbmp_t *abitmap);
+extern fswc_line_t fswc_find_line(src_t *src);
+extern int fswc_add_image(src_t *src, avgbmp_t *abitmap, fswc_hint_t *hint);
+extern gdImage *fswc_decode_image(src_t *src, fswc_hint_t *hint);
+extern int fswc_hint_crop(fswc_hint_t *hint, uint32_t width, uint32_t height, uint32_t *x, uint32_t *y, uint32_t *w, uint32_t *h);
 
-extern int fswc_add_image_rgb32(src_t *src, avgbmp_t *abitmap);
-extern int fswc_add_image_bgr32(src_t *src, avgbmp_t *abitmap);
-extern int fswc_add_image_rgb24(src_t *src, avgbmp_t *abitmap);
-extern int fswc_add_image_bgr24(src_t *src, avgbmp_t *abitmap);
-extern int fswc_add_image_rgb565(src_t *src, avgbmp_t *abitmap);
-extern int fswc_add_image_rgb555(src_t *src, avgbmp_t *abitmap);
+extern void fswc_line_bayer(src_t *src, uint32_t y, uint32_t x0, uint32_t w, int *dst);
 
-extern int fswc_add_image_yuyv(src_t *src, avgbmp_t *abitmap);
-extern int fswc_add_image_yuv420p(src_t *src, avgbmp_t *abitmap);
-extern int fswc_add_image_nv12mb(src_t *src, avgbmp_t *abitmap);
+extern void fswc_line_y16(src_t *src, uint32_t y, uint32_t x0, uint32_t w, int *dst);
+extern void fswc_line_grey(src_t *src, uint32_t y, uint32_t x0, uint32_t w, int *dst);
 
-extern int fswc_add_image_s561(avgbmp_t *dst, uint8_t *img, uint32_t length, uint32_t width, uint32_t height, int palette);
+/* Length of the standard DHT segment, including the marker. */
+#define JPEG_DHT_LENGTH (420)
+
+extern uint8_t jpeg_dht[JPEG_DHT_LENGTH];
+extern uint8_t *jpeg_find_dht(uint8_t *src, uint32_t lsrc);
+extern int verify_jpeg_dht(uint8_t *src, uint32_t lsrc, uint8_t **dst, uint32_t *ldst);
+extern gdImage *fswc_decode_jpeg(src_t *src, fswc_hint_t *hint);
+extern int fswc_add_jpeg(src_t *src, avgbmp_t *abitmap, fswc_hint_t *hint);
+
+extern gdImage *fswc_decode_png(src_t *src);
+
+extern void fswc_line_rgb32(src_t *src, uint32_t y, uint32_t x0, uint32_t w, int *dst);
+extern void fswc_line_bgr32(src_t *src, uint32_t y, uint32_t x0, uint32_t w, int *dst);
+extern void fswc_line_rgb24(src_t *src, uint32_t y, uint32_t x0, uint32_t w, int *dst);
+extern void fswc_line_bgr24(src_t *src, uint32_t y, uint32_t x0, uint32_t w, int *dst);
+extern void fswc_line_rgb565(src_t *src, uint32_t y, uint32_t x0, uint32_t w, int *dst);
+extern void fswc_line_rgb555(src_t *src, uint32_t y, uint32_t x0, uint32_t w, int *dst);
+
+/* Converts a row of width YUYV (or UYVY) pixels. */
+typedef void (*fswc_yuyv_row_t)(uint8_t *src, int *dst, uint32_t width, int uyvy);
+
+typedef struct {
+	char *name;
+	fswc_yuyv_row_t row;
+	int (*supported)(void);
+} fswc_yuyv_kernel_t;
+
+extern fswc_yuyv_kernel_t fswc_yuyv_kernel[];
+extern void fswc_yuyv_row_c(uint8_t *src, int *dst, uint32_t width, int uyvy);
+
+extern void fswc_line_yuyv(src_t *src, uint32_t y, uint32_t x0, uint32_t w, int *dst);
+extern void fswc_line_yuv420p(src_t *src, uint32_t y, uint32_t x0, uint32_t w, int *dst);
+extern void fswc_line_nv12mb(src_t *src, uint32_t y, uint32_t x0, uint32_t w, int *dst);
+
+extern int fswc_decode_s561(src_t *src, uint8_t *dst);
 
 #endif
 
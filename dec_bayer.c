@@ -14,13 +14,13 @@
 #include <stdint.h>
 #include "fswebcam.h"
 #include "src.h"
+#include "dec.h"
 
-int fswc_add_image_bayer(avgbmp_t *dst, uint8_t *img, uint32_t length, uint32_t w, uint32_t h, int palette)
+void fswc_line_bayer(src_t *src, uint32_t y, uint32_t x0, uint32_t w, int *dst)
 {
-	uint32_t x = 0, y = 0;
-	uint32_t i = w * h;
-	
-	if(length < i) return(-1);
+	uint32_t sw = src->width, h = src->height;
+	uint8_t *up, *img, *down;
+	uint32_t x;
 	
 	/* SBGGR8 bayer pattern:
 	 * 
@@ -44,63 +44,52 @@ int fswc_add_image_bayer(avgbmp_t *dst, uint8_t *img, uint32_t length, uint32_t
 	 * BGBGBGBGBG
 	*/
 	
-	while(i-- > 0)
+	/* Setup pointers to the lines above and below. At the top
+	 * and bottom edges both point to the one neighbour. */
+	img  = (uint8_t *) src->img + y * sw;
+	up   = img - sw;
+	down = img + sw;
+	
+	if(!y)              up   = down;
+	else if(y == h - 1) down = up;
+	
+	for(x = x0; x < x0 + w; x++)
 	{
-		uint8_t *p[8];
+		uint32_t xl = x - 1, xr = x + 1;
 		uint8_t hn, vn, di;
 		uint8_t r, g, b;
 		int mode;
 		
-		/* Setup pointers to this pixel's neighbours. */
-		p[0] = img - w - 1;
-		p[1] = img - w;
-		p[2] = img - w + 1;
-		p[3] = img - 1;
-		p[4] = img + 1;
-		p[5] = img + w - 1;
-		p[6] = img + w;
-		p[7] = img + w + 1;
-		
-		/* Juggle pointers if they are out of bounds. */
-		if(!y)              { p[0]=p[5]; p[1]=p[6]; p[2]=p[7]; }
-		else if(y == h - 1) { p[5]=p[0]; p[6]=p[1]; p[7]=p[2]; }
-		if(!x)              { p[0]=p[2]; p[3]=p[4]; p[5]=p[7]; }
-		else if(x == w - 1) { p[2]=p[0]; p[4]=p[3]; p[7]=p[5]; }
+		/* Juggle the columns if they are out of bounds. */
+		if(!x)              xl = xr;
+		else if(x == sw - 1) xr = xl;
 		
 		/* Average matching neighbours. */
-		hn = (*p[3] + *p[4]) / 2;
-		vn = (*p[1] + *p[6]) / 2;
-		di = (*p[0] + *p[2] + *p[5] + *p[7]) / 4;
+		hn = (img[xl] + img[xr]) / 2;
+		vn = (up[x] + down[x]) / 2;
+		di = (up[xl] + up[xr] + down[xl] + down[xr]) / 4;
 		
 		/* Calculate RGB */
-		if(palette == SRC_PAL_BAYER) mode = (x + y) & 0x01;
+		if(src->palette == SRC_PAL_BAYER) mode = (x + y) & 0x01;
 		else mode = ~(x + y) & 0x01;
 		
 		if(mode)
 		{
-			g = *img;
+			g = img[x];
 			if(y & 0x01) { r = hn; b = vn; }
 			else         { r = vn; b = hn; }
 		}
-		else if(y & 0x01) { r = *img; g = (vn + hn) / 2; b = di; }
-		else              { b = *img; g = (vn + hn) / 2; r = di; }
+		else if(y & 0x01) { r = img[x]; g = (vn + hn) / 2; b = di; }
+		else              { b = img[x]; g = (vn + hn) / 2; r = di; }
 		
-		if(palette == SRC_PAL_SGRBG8)
+		if(src->palette == SRC_PAL_SGRBG8)
 		{
 			uint8_t t = r;
 			r = b;
 			b = t;
 		}
 		
-		*(dst++) += r;
-		*(dst++) += g;
-		*(dst++) += b;
-		
-		/* Move to the next pixel (or line) */
-		if(++x == w) { x = 0; y++; }
-		img++;
+		*(dst++) = (r << 16) | (g << 8) | b;
 	}
-	
-	return(0);
 }
 
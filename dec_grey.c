@@ -14,39 +14,29 @@
 #include <stdint.h>
 #include "fswebcam.h"
 #include "src.h"
+#include "dec.h"
 
-int fswc_add_image_y16(src_t *src, avgbmp_t *abitmap)
+void fswc_line_y16(src_t *src, uint32_t y, uint32_t x0, uint32_t w, int *dst)
 {
-	uint16_t *bitmap = (uint16_t *) src->img;
-	uint32_t i = src->width * src->height;
+	uint16_t *bitmap = (uint16_t *) src->img + y * src->width + x0;
+	uint32_t x;
 	
-	if(src->length < i) return(-1);
-	
-	while(i-- > 0)
+	for(x = 0; x < w; x++)
 	{
-		*(abitmap++) += *bitmap >> 8;
-		*(abitmap++) += *bitmap >> 8;
-		*(abitmap++) += *(bitmap++) >> 8;
+		int v = *(bitmap++) >> 8;
+		*(dst++) = (v << 16) | (v << 8) | v;
 	}
-	
-	return(0);
 }
 
-int fswc_add_image_grey(src_t *src, avgbmp_t *abitmap)
+void fswc_line_grey(src_t *src, uint32_t y, uint32_t x0, uint32_t w, int *dst)
 {
-	uint8_t *bitmap = (uint8_t *) src->img;
-	uint32_t i = src->width * src->height;
+	uint8_t *bitmap = (uint8_t *) src->img + y * src->width + x0;
+	uint32_t x;
 	
-	if(src->length < i) return(-1);
-	
-	while(i-- > 0)
+	for(x = 0; x < w; x++)
 	{
-		*(abitmap++) += *bitmap;
-		*(abitmap++) += *bitmap;
-		*(abitmap++) += *(bitmap++);
+		int v = *(bitmap++);
+		*(dst++) = (v << 16) | (v << 8) | v;
 	}
-	
-	return(0);
 }
 
- 
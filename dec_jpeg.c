@@ -11,77 +11,80 @@
 #include "config.h"
 #endif
 
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <setjmp.h>
 #include <gd.h>
+#include <jpeglib.h>
+#include <jerror.h>
 #include "fswebcam.h"
 #include "src.h"
+#include "dec.h"
 #include "log.h"
+#include "fbpool.h"
 
-int verify_jpeg_dht(uint8_t *src,  uint32_t lsrc,
-                    uint8_t **dst, uint32_t *ldst)
+/* The standard Huffman tables, for MJPEG frames that lack them. */
+uint8_t jpeg_dht[JPEG_DHT_LENGTH] =
+{
+	0xff, 0xc4, 0x01, 0xa2, 0x00, 0x00, 0x01, 0x05, 0x01, 0x01,
+	0x01, 0x01, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+	0x09, 0x0a, 0x0b, 0x10, 0x00, 0x02, 0x01, 0x03, 0x03, 0x02,
+	0x04, 0x03, 0x05, 0x05, 0x04, 0x04, 0x00, 0x00, 0x01, 0x7d,
+	0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31,
+	0x41, 0x06, 0x13, 0x51, 0x61, 0x07, 0x22, 0x71, 0x14, 0x32,
+	0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52,
+	0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16,
+	0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2a,
+	0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45,
+	0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57,
+	0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+	0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83,
+	0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x92, 0x93, 0x94,
+	0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+	0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+	0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7,
+	0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8,
+	0xd9, 0xda, 0xe1, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8,
+	0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+	0xf9, 0xfa, 0x01, 0x00, 0x03, 0x01, 0x01, 0x01, 0x01, 0x01,
+	0x01, 0x01, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a,
+	0x0b, 0x11, 0x00, 0x02, 0x01, 0x02, 0x04, 0x04, 0x03, 0x04,
+	0x07, 0x05, 0x04, 0x04, 0x00, 0x01, 0x02, 0x77, 0x00, 0x01,
+	0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41,
+	0x51, 0x07, 0x61, 0x71, 0x13, 0x22, 0x32, 0x81, 0x08, 0x14,
+	0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+	0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25,
+	0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26, 0x27, 0x28, 0x29, 0x2a,
+	0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46,
+	0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+	0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+	0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83,
+	0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x92, 0x93, 0x94,
+	0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+	0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+	0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7,
+	0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8,
+	0xd9, 0xda, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9,
+	0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa
+};
+
+uint8_t *jpeg_find_dht(uint8_t *src, uint32_t lsrc)
 {
 	/* This function is based on a patch provided by Scott J. Bertin. */
 	
-	static unsigned char dht[] =
-	{
-		0xff, 0xc4, 0x01, 0xa2, 0x00, 0x00, 0x01, 0x05, 0x01, 0x01,
-		0x01, 0x01, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-		0x00, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
-		0x09, 0x0a, 0x0b, 0x10, 0x00, 0x02, 0x01, 0x03, 0x03, 0x02,
-		0x04, 0x03, 0x05, 0x05, 0x04, 0x04, 0x00, 0x00, 0x01, 0x7d,
-		0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31,
-		0x41, 0x06, 0x13, 0x51, 0x61, 0x07, 0x22, 0x71, 0x14, 0x32,
-		0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52,
-		0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16,
-		0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2a,
-		0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45,
-		0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57,
-		0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
-		0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83,
-		0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x92, 0x93, 0x94,
-		0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
-		0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
-		0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7,
-		0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8,
-		0xd9, 0xda, 0xe1, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8,
-		0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
-		0xf9, 0xfa, 0x01, 0x00, 0x03, 0x01, 0x01, 0x01, 0x01, 0x01,
-		0x01, 0x01, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-		0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a,
-		0x0b, 0x11, 0x00, 0x02, 0x01, 0x02, 0x04, 0x04, 0x03, 0x04,
-		0x07, 0x05, 0x04, 0x04, 0x00, 0x01, 0x02, 0x77, 0x00, 0x01,
-		0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41,
-		0x51, 0x07, 0x61, 0x71, 0x13, 0x22, 0x32, 0x81, 0x08, 0x14,
-		0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
-		0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25,
-		0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26, 0x27, 0x28, 0x29, 0x2a,
-		0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46,
-		0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
-		0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
-		0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83,
-		0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x92, 0x93, 0x94,
-		0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
-		0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
-		0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7,
-		0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8,
-		0xd9, 0xda, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9,
-		0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa
-	};
 	uint8_t *p, *i = NULL;
 	
-	/* By default we simply return the source image. */
-	*dst = src;
-	*ldst = lsrc;
-	
 	/* Scan for an existing DHT segment or the first SOS segment. */
 	for(p = src + 2; p - src < lsrc - 3 && i == NULL; )
 	{
 		if(*(p++) != 0xFF) continue;
 		
 		if(*p == 0xD9) break;           /* JPEG_EOI */
-		if(*p == 0xC4) return(0);       /* JPEG_DHT */
+		if(*p == 0xC4) return(NULL);    /* JPEG_DHT */
 		if(*p == 0xDA && !i) i = p - 1; /* JPEG_SOS */
 		
 		/* Move to next segment. */
@@ -91,9 +94,24 @@ int verify_jpeg_dht(uint8_t *src,  uint32_t lsrc,
 	/* If no SOS was found, insert the DHT directly after the SOI. */
 	if(i == NULL) i = src + 2;
 	
+	return(i);
+}
+
+int verify_jpeg_dht(uint8_t *src,  uint32_t lsrc,
+                    uint8_t **dst, uint32_t *ldst)
+{
+	uint8_t *p, *i;
+	
+	/* By default we simply return the source image. */
+	*dst = src;
+	*ldst = lsrc;
+	
+	i = jpeg_find_dht(src, lsrc);
+	if(!i) return(0);
+	
 	DEBUG("Inserting DHT segment into JPEG frame.");
 	
-	*ldst = lsrc + sizeof(dht);
+	*ldst = lsrc + JPEG_DHT_LENGTH;
 	*dst  = malloc(*ldst);
 	if(!*dst)
 	{
@@ -103,40 +121,359 @@ int verify_jpeg_dht(uint8_t *src,  uint32_t lsrc,
 	
 	/* Copy the JPEG data, inserting the DHT segment. */
 	memcpy((p  = *dst), src, i - src);
-	memcpy((p += i - src), dht, sizeof(dht));
-	memcpy((p += sizeof(dht)), i, lsrc - (i - src));
+	memcpy((p += i - src), jpeg_dht, JPEG_DHT_LENGTH);
+	memcpy((p += JPEG_DHT_LENGTH), i, lsrc - (i - src));
 	
 	return(1);
 }
 
-int fswc_add_image_jpeg(src_t *src, avgbmp_t *abitmap)
+/* libjpeg-turbo can write pixels in the same layout as the ints of
+ * gdImage->tpixels, so rows are decoded straight into the image. The
+ * padding byte comes out as 0xFF and is cleared afterwards, as gd
+ * keeps the alpha channel there. */
+#if defined(JCS_EXTENSIONS) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define FSWC_JPEG_DIRECT
+#define FSWC_JPEG_SPACE (JCS_EXT_BGRX)
+#elif defined(JCS_EXTENSIONS)
+#define FSWC_JPEG_DIRECT
+#define FSWC_JPEG_SPACE (JCS_EXT_XRGB)
+#else
+#define FSWC_JPEG_SPACE (JCS_RGB)
+#endif
+
+typedef struct {
+	struct jpeg_error_mgr pub;
+	jmp_buf env;
+} fswc_jpeg_error_t;
+
+static void fswc_jpeg_error_exit(j_common_ptr cinfo)
+{
+	fswc_jpeg_error_t *err = (fswc_jpeg_error_t *) cinfo->err;
+	char msg[JMSG_LENGTH_MAX];
+	
+	cinfo->err->format_message(cinfo, msg);
+	ERROR("Error decoding JPEG frame: %s", msg);
+	
+	longjmp(err->env, 1);
+}
+
+static void fswc_jpeg_output_message(j_common_ptr cinfo)
+{
+	char msg[JMSG_LENGTH_MAX];
+	
+	/* Damaged MJPEG frames are common, don't fill the log. */
+	cinfo->err->format_message(cinfo, msg);
+	DEBUG("JPEG: %s", msg);
+}
+
+/* Pick the smallest of the 1/8, 1/4 and 1/2 DCT scales that still
+ * gives an image at least as large as the hint. */
+static void fswc_jpeg_scale(struct jpeg_decompress_struct *cinfo,
+                            fswc_hint_t *hint)
+{
+	unsigned int denom;
+	
+	cinfo->scale_num   = 1;
+	cinfo->scale_denom = 1;
+	
+	if(!hint || !hint->width || !hint->height) return;
+	
+	for(denom = 8; denom > 1; denom /= 2)
+	{
+		cinfo->scale_denom = denom;
+		jpeg_calc_output_dimensions(cinfo);
+		
+		if(cinfo->output_width  >= hint->width &&
+		   cinfo->output_height >= hint->height) break;
+	}
+	
+	if(denom == 1) cinfo->scale_denom = 1;
+	else DEBUG("Decoding JPEG frame at 1/%u scale.", denom);
+}
+
+/* Only the rows and MCU columns of a cropped area are decoded, the
+ * rest of the frame is skipped. Plain libjpeg lacks the calls to do
+ * this, it decodes whole rows and drops the unwanted ones. */
+static uint32_t fswc_jpeg_crop(struct jpeg_decompress_struct *cinfo,
+                               uint32_t x, uint32_t y, uint32_t w)
+{
+#ifdef LIBJPEG_TURBO_VERSION
+	JDIMENSION mcu = cinfo->max_h_samp_factor * DCTSIZE;
+	JDIMENSION cx = x, cw = w;
+	
+	/* Fancy upsampling treats the edges of the decoded area as the
+	 * edges of the image. Decode an extra MCU column on each side so
+	 * the pixels come out the same as in the full frame. */
+	cx  = (x > mcu ? x - mcu : 0);
+	cw += x - cx + mcu;
+	if(cx + cw > cinfo->output_width) cw = cinfo->output_width - cx;
+	
+	/* The area is widened to whole MCUs, return where ours starts. */
+	jpeg_crop_scanline(cinfo, &cx, &cw);
+	if(y) jpeg_skip_scanlines(cinfo, y);
+	
+	return(x - cx);
+#else
+	JSAMPARRAY row;
+	
+	row = cinfo->mem->alloc_sarray((j_common_ptr) cinfo, JPOOL_IMAGE,
+	       cinfo->output_width * cinfo->output_components, 1);
+	while(cinfo->output_scanline < y) jpeg_read_scanlines(cinfo, row, 1);
+	
+	return(x);
+#endif
+}
+
+/* A source manager reading the frame in up to three parts, so the
+ * standard DHT segment can be inserted without copying the frame. */
+typedef struct {
+	struct jpeg_source_mgr pub;
+	const JOCTET *part[3];
+	size_t length[3];
+	int next;
+} fswc_jpeg_src_t;
+
+static void fswc_jpeg_src_init(j_decompress_ptr cinfo)
+{
+}
+
+static boolean fswc_jpeg_src_fill(j_decompress_ptr cinfo)
+{
+	fswc_jpeg_src_t *s = (fswc_jpeg_src_t *) cinfo->src;
+	static const JOCTET eoi[2] = { 0xFF, JPEG_EOI };
+	
+	while(s->next < 3 && !s->length[s->next]) s->next++;
+	
+	if(s->next < 3)
+	{
+		s->pub.next_input_byte = s->part[s->next];
+		s->pub.bytes_in_buffer = s->length[s->next++];
+		return(TRUE);
+	}
+	
+	/* A truncated frame, end it as jpeg_mem_src() does. */
+	WARNMS(cinfo, JWRN_JPEG_EOF);
+	s->pub.next_input_byte = eoi;
+	s->pub.bytes_in_buffer = 2;
+	
+	return(TRUE);
+}
+
+static void fswc_jpeg_src_skip(j_decompress_ptr cinfo, long n)
+{
+	struct jpeg_source_mgr *src = cinfo->src;
+	
+	while(n > (long) src->bytes_in_buffer)
+	{
+		n -= src->bytes_in_buffer;
+		src->fill_input_buffer(cinfo);
+	}
+	
+	if(n > 0)
+	{
+		src->next_input_byte += n;
+		src->bytes_in_buffer -= n;
+	}
+}
+
+static void fswc_jpeg_src_term(j_decompress_ptr cinfo)
 {
-	uint32_t x, y, hlength;
-	uint8_t *himg = NULL;
-	gdImage *im;
-	int i;
+}
+
+static void fswc_jpeg_src(struct jpeg_decompress_struct *cinfo,
+                          uint8_t *img, uint32_t length)
+{
+	fswc_jpeg_src_t *s;
+	uint8_t *i;
+	
+	s = (fswc_jpeg_src_t *) cinfo->mem->alloc_small((j_common_ptr) cinfo,
+	     JPOOL_PERMANENT, sizeof(fswc_jpeg_src_t));
+	
+	s->pub.init_source       = fswc_jpeg_src_init;
+	s->pub.fill_input_buffer = fswc_jpeg_src_fill;
+	s->pub.skip_input_data   = fswc_jpeg_src_skip;
+	s->pub.resync_to_restart = jpeg_resync_to_restart;
+	s->pub.term_source       = fswc_jpeg_src_term;
+	s->pub.next_input_byte   = NULL;
+	s->pub.bytes_in_buffer   = 0;
+	
+	/* MJPEG data may lack the DHT segment required for decoding. */
+	i = jpeg_find_dht(img, length);
+	if(!i) i = img + length;
 	
-	/* MJPEG data may lack the DHT segment required for decoding... */
-	i = verify_jpeg_dht(src->img, src->length, &himg, &hlength);
+	s->part[0]   = img;
+	s->length[0] = i - img;
+	s->part[1]   = jpeg_dht;
+	s->length[1] = (i < img + length ? JPEG_DHT_LENGTH : 0);
+	s->part[2]   = i;
+	s->length[2] = img + length - i;
+	s->next      = 0;
 	
-	im = gdImageCreateFromJpegPtr(hlength, himg);
-	if(i == 1) free(himg);
+	cinfo->src = &s->pub;
+}
+
+static void fswc_jpeg_header(struct jpeg_decompress_struct *cinfo,
+                             uint8_t *img, uint32_t length,
+                             J_COLOR_SPACE space, fswc_hint_t *hint)
+{
+	jpeg_create_decompress(cinfo);
+	fswc_jpeg_src(cinfo, img, length);
+	jpeg_read_header(cinfo, TRUE);
 	
-	if(!im) return(-1);
+	cinfo->out_color_space = space;
+	
+	/* Trade a little quality for speed. */
+	if(hint && hint->fast)
+	{
+		cinfo->dct_method          = JDCT_IFAST;
+		cinfo->do_fancy_upsampling = FALSE;
+		cinfo->do_block_smoothing  = FALSE;
+	}
+}
+
+/* Copy w decoded pixels into a row of a truecolor image. */
+static void fswc_jpeg_row(JSAMPLE *p, int *dst, uint32_t w)
+{
+	uint32_t x;
+	
+#ifdef FSWC_JPEG_DIRECT
+	if((void *) p != (void *) dst) memcpy(dst, p, w * sizeof(int));
+	for(x = 0; x < w; x++) dst[x] &= 0xFFFFFF;
+#else
+	for(x = 0; x < w; x++, p += 3)
+		dst[x] = (p[0] << 16) | (p[1] << 8) | p[2];
+#endif
+}
+
+gdImage *fswc_decode_jpeg(src_t *src, fswc_hint_t *hint)
+{
+	struct jpeg_decompress_struct cinfo;
+	fswc_jpeg_error_t jerr;
+	gdImage *volatile im = NULL;
+	JSAMPLE *volatile row = NULL;
+	uint32_t x, y, w, h, xoff;
+	int crop;
+	
+	cinfo.err = jpeg_std_error(&jerr.pub);
+	jerr.pub.error_exit     = fswc_jpeg_error_exit;
+	jerr.pub.output_message = fswc_jpeg_output_message;
+	
+	if(setjmp(jerr.env))
+	{
+		jpeg_destroy_decompress(&cinfo);
+		if(im) fbpool_release(im);
+		free(row);
+		return(NULL);
+	}
+	
+	fswc_jpeg_header(&cinfo, src->img, src->length, FSWC_JPEG_SPACE, hint);
+	
+	crop = fswc_hint_crop(hint, cinfo.image_width, cinfo.image_height,
+	                      &x, &y, &w, &h);
+	if(!crop) fswc_jpeg_scale(&cinfo, hint);
+	
+	jpeg_start_decompress(&cinfo);
+	
+	xoff = 0;
+	if(crop) xoff = fswc_jpeg_crop(&cinfo, x, y, w);
+	else
+	{
+		w = cinfo.output_width;
+		h = cinfo.output_height;
+	}
+	
+	im = fbpool_image(w, h);
+	if(!im)
+	{
+		ERROR("Out of memory.");
+		longjmp(jerr.env, 1);
+	}
 	
-	for(y = 0; y < src->height; y++)
-		for(x = 0; x < src->width; x++)
+#ifdef FSWC_JPEG_DIRECT
+	/* Only a cropped frame needs somewhere else to put the rows. */
+	if(cinfo.output_width != w)
+#endif
+	{
+		row = malloc(cinfo.output_width * cinfo.output_components);
+		if(!row)
 		{
-			int c = gdImageGetPixel(im, x, y);
-			
-			*(abitmap++) += (c & 0xFF0000) >> 16;
-			*(abitmap++) += (c & 0x00FF00) >> 8;
-			*(abitmap++) += (c & 0x0000FF);
+			ERROR("Out of memory.");
+			longjmp(jerr.env, 1);
 		}
+	}
 	
-	gdImageDestroy(im);
+	for(y = 0; y < h; y++)
+	{
+		JSAMPROW p = (row ? row : (JSAMPROW) im->tpixels[y]);
+		
+		jpeg_read_scanlines(&cinfo, &p, 1);
+		fswc_jpeg_row(p + xoff * cinfo.output_components, im->tpixels[y], w);
+	}
 	
-	return(0);
+	/* A crop may leave rows at the bottom unread. */
+	if(cinfo.output_scanline < cinfo.output_height)
+		jpeg_abort_decompress(&cinfo);
+	else jpeg_finish_decompress(&cinfo);
+	
+	jpeg_destroy_decompress(&cinfo);
+	
+	free(row);
+	
+	if(crop) hint->cropped = 1;
+	
+	return(im);
 }
 
- 
+/* Decode a frame for stacking, adding each row straight into the
+ * average bitmap. Any part of the frame outside of the expected
+ * size is ignored. */
+int fswc_add_jpeg(src_t *src, avgbmp_t *abitmap, fswc_hint_t *hint)
+{
+	struct jpeg_decompress_struct cinfo;
+	fswc_jpeg_error_t jerr;
+	JSAMPLE *volatile row = NULL;
+	uint32_t x, y, w;
+	
+	cinfo.err = jpeg_std_error(&jerr.pub);
+	jerr.pub.error_exit     = fswc_jpeg_error_exit;
+	jerr.pub.output_message = fswc_jpeg_output_message;
+	
+	if(setjmp(jerr.env))
+	{
+		jpeg_destroy_decompress(&cinfo);
+		free(row);
+		return(-1);
+	}
+	
+	fswc_jpeg_header(&cinfo, src->img, src->length, JCS_RGB, hint);
+	jpeg_start_decompress(&cinfo);
+	
+	row = malloc(cinfo.output_width * 3);
+	if(!row)
+	{
+		ERROR("Out of memory.");
+		longjmp(jerr.env, 1);
+	}
+	
+	w = cinfo.output_width;
+	if(w > src->width) w = src->width;
+	
+	for(y = 0; y < src->height && y < cinfo.output_height; y++)
+	{
+		avgbmp_t *a = abitmap + (size_t) y * src->width * 3;
+		JSAMPROW p = row;
+		
+		jpeg_read_scanlines(&cinfo, &p, 1);
+		for(x = 0; x < w * 3; x++) *(a++) += *(p++);
+	}
+	
+	if(cinfo.output_scanline < cinfo.output_height)
+		jpeg_abort_decompress(&cinfo);
+	else jpeg_finish_decompress(&cinfo);
+	
+	jpeg_destroy_decompress(&cinfo);
+	
+	free(row);
+	
+	return(0);
+}
@@ -15,28 +15,18 @@
 #include <gd.h>
 #include "fswebcam.h"
 #include "src.h"
+#include "dec.h"
 
-int fswc_add_image_png(src_t *src, avgbmp_t *abitmap)
+gdImage *fswc_decode_png(src_t *src)
 {
-	uint32_t x, y;
 	gdImage *im;
 	
 	im = gdImageCreateFromPngPtr(src->length, src->img);
-	if(!im) return(-1);
+	if(!im) return(NULL);
 	
-	for(y = 0; y < src->height; y++)
-		for(x = 0; x < src->width; x++)
-		{
-			int c = gdImageGetPixel(im, x, y);
-			
-			*(abitmap++) += (c & 0xFF0000) >> 16;
-			*(abitmap++) += (c & 0x00FF00) >> 8;
-			*(abitmap++) += (c & 0x0000FF);
-		}
+	/* The rest of fswebcam expects a truecolor image. */
+	if(!gdImageTrueColor(im)) gdImagePaletteToTrueColor(im);
 	
-	gdImageDestroy(im);
-	
-	return(0);
+	return(im);
 }
 
- 
@@ -14,82 +14,62 @@
 #include <stdint.h>
 #include "fswebcam.h"
 #include "src.h"
+#include "dec.h"
 
-int fswc_add_image_rgb32(src_t *src, avgbmp_t *abitmap)
+void fswc_line_rgb32(src_t *src, uint32_t y, uint32_t x0, uint32_t w, int *dst)
 {
-	uint8_t *img = (uint8_t *) src->img;
-	uint32_t i = src->width * src->height;
+	uint8_t *img = (uint8_t *) src->img + (y * src->width + x0) * 4;
+	uint32_t x;
 	
-	if(src->length << 2 < i) return(-1);
-	
-	while(i-- > 0)
+	for(x = 0; x < w; x++)
 	{
-		*(abitmap++) += *(img++);
-		*(abitmap++) += *(img++);
-		*(abitmap++) += *(img++);
-		img++;
+		*(dst++) = (img[0] << 16) | (img[1] << 8) | img[2];
+		img += 4;
 	}
-	
-	return(0);
 }
 
-int fswc_add_image_bgr32(src_t *src, avgbmp_t *abitmap)
+void fswc_line_bgr32(src_t *src, uint32_t y, uint32_t x0, uint32_t w, int *dst)
 {
-	uint8_t *img = (uint8_t *) src->img;
-	uint32_t p, i = src->width * src->height;
+	uint8_t *img = (uint8_t *) src->img + (y * src->width + x0) * 4;
+	uint32_t x;
 	
-	if(src->length << 2 < i) return(-1);
-	
-	for(p = 0; p < i; p += 4)
+	for(x = 0; x < w; x++)
 	{
-		abitmap[0] += img[2];
-		abitmap[1] += img[1];
-		abitmap[2] += img[0];
-		abitmap += 3;
+		*(dst++) = (img[2] << 16) | (img[1] << 8) | img[0];
 		img += 4;
 	}
-	
-	return(0);
 }
 
-int fswc_add_image_rgb24(src_t *src, avgbmp_t *abitmap)
+void fswc_line_rgb24(src_t *src, uint32_t y, uint32_t x0, uint32_t w, int *dst)
 {
-	uint8_t *img = (uint8_t *) src->img;
-	uint32_t i = src->width * src->height * 3;
+	uint8_t *img = (uint8_t *) src->img + (y * src->width + x0) * 3;
+	uint32_t x;
 	
-	if(src->length < i) return(-1);
-	while(i-- > 0) *(abitmap++) += *(img++);
-	
-	return(0);
+	for(x = 0; x < w; x++)
+	{
+		*(dst++) = (img[0] << 16) | (img[1] << 8) | img[2];
+		img += 3;
+	}
 }
 
-int fswc_add_image_bgr24(src_t *src, avgbmp_t *abitmap)
+void fswc_line_bgr24(src_t *src, uint32_t y, uint32_t x0, uint32_t w, int *dst)
 {
-	uint8_t *img = (uint8_t *) src->img;
-	uint32_t p, i = src->width * src->height * 3;
+	uint8_t *img = (uint8_t *) src->img + (y * src->width + x0) * 3;
+	uint32_t x;
 	
-	if(src->length < i) return(-1);
-	
-	for(p = 0; p < src->length; p += 3)
+	for(x = 0; x < w; x++)
 	{
-		abitmap[0] += img[2];
-		abitmap[1] += img[1];
-		abitmap[2] += img[0];
-		abitmap += 3;
+		*(dst++) = (img[2] << 16) | (img[1] << 8) | img[0];
 		img += 3;
 	}
-	
-	return(0);
 }
 
-int fswc_add_image_rgb565(src_t *src, avgbmp_t *abitmap)
+void fswc_line_rgb565(src_t *src, uint32_t y, uint32_t x0, uint32_t w, int *dst)
 {
-	uint16_t *img = (uint16_t *) src->img;
-	uint32_t i = src->width * src->height;
+	uint16_t *img = (uint16_t *) src->img + y * src->width + x0;
+	uint32_t x;
 	
-	if(src->length >> 1 < i) return(-1);
-	
-	while(i-- > 0)
+	for(x = 0; x < w; x++)
 	{
 		uint8_t r, g, b;
 		
@@ -97,24 +77,21 @@ int fswc_add_image_rgb565(src_t *src, avgbmp_t *abitmap)
 		g = (*img &  0x7E0) >> 3;
 		b = (*img &   0x1F) << 3;
 		
-		*(abitmap++) += r + (r >> 5);
-		*(abitmap++) += g + (g >> 6);
-		*(abitmap++) += b + (b >> 5);
+		r += r >> 5;
+		g += g >> 6;
+		b += b >> 5;
 		
+		*(dst++) = (r << 16) | (g << 8) | b;
 		img++;
 	}
-	
-	return(0);
 }
 
-int fswc_add_image_rgb555(src_t *src, avgbmp_t *abitmap)
+void fswc_line_rgb555(src_t *src, uint32_t y, uint32_t x0, uint32_t w, int *dst)
 {
-	uint16_t *img = (uint16_t *) src->img;
-	uint32_t i = src->width * src->height;
+	uint16_t *img = (uint16_t *) src->img + y * src->width + x0;
+	uint32_t x;
 	
-	if(src->length >> 1 < i) return(-1);
-	
-	while(i-- > 0)
+	for(x = 0; x < w; x++)
 	{
 		uint8_t r, g, b;
 		
@@ -122,14 +99,12 @@ int fswc_add_image_rgb555(src_t *src, avgbmp_t *abitmap)
 		g = (*img &  0x3E0) >> 2;
 		b = (*img &   0x1F) << 3;
 		
-		*(abitmap++) += r + (r >> 5);
-		*(abitmap++) += g + (g >> 5);
-		*(abitmap++) += b + (b >> 5);
+		r += r >> 5;
+		g += g >> 5;
+		b += b >> 5;
 		
+		*(dst++) = (r << 16) | (g << 8) | b;
 		img++;
 	}
-	
-	return(0);
 }
 
- 
@@ -883,30 +883,36 @@ static int spca561_decode(int width, int height,
 
 /* FIXME, change spca561_decode not to need the extra border
    around its dest buffer */
-int fswc_add_image_s561(avgbmp_t *dst, uint8_t *img, uint32_t length, uint32_t width, uint32_t height, int palette)
+int fswc_decode_s561(src_t *src, uint8_t *dst)
 {
 	int x, y;
-	uint8_t *s, *d;
+	uint8_t *s;
 	unsigned char tmpimg[650 * 490];
 	
-	if(spca561_decode(width, height, img, tmpimg) != 0)
+	if(src->width > 640 || src->height > 480)
+	{
+		ERROR("Image too large for the spca561 decoder.");
+		return(-1);
+	}
+	
+	/* The decoder reads the border around the image, which it never
+	 * writes. Without this the output changes from call to call. */
+	memset(tmpimg, 0, sizeof(tmpimg));
+	
+	if(spca561_decode(src->width, src->height, src->img, tmpimg) != 0)
 	{
 		ERROR("spca561_decode() failed");
 		return(-1);
 	}
 	
-	/* Remove buffer border */
-	d = tmpimg;
-	s = tmpimg + 2 * (width + 6) + 3;
-	for(y = 0; y < height; y++)
+	/* Remove buffer border, leaving a SGBRG8 bayer image */
+	s = tmpimg + 2 * (src->width + 6) + 3;
+	for(y = 0; y < src->height; y++)
 	{
-		for(x = 0; x < width; x++) *(d++) = *(s++);
+		for(x = 0; x < src->width; x++) *(dst++) = *(s++);
 		s += 6;
 	}
 	
-	fswc_add_image_bayer(dst, tmpimg, width * height, width, height, SRC_PAL_SGBRG8);
-	
 	return(0);
 }
 
- 
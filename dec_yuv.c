@@ -12,8 +12,19 @@
 #endif
 
 #include <stdint.h>
+#include <pthread.h>
 #include "fswebcam.h"
 #include "src.h"
+#include "dec.h"
+#include "log.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_YUYV_SSE2
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define HAVE_YUYV_NEON
+#include <arm_neon.h>
+#endif
 
 /* The following YUV functions are based on code by Vincent Hourdin.
  * http://vinvin.dyndns.org/projects/
@@ -22,149 +33,328 @@
  * http://linuxbrit.co.uk/camE/
 */
 
-int fswc_add_image_yuyv(src_t *src, avgbmp_t *abitmap)
+/* Convert one YUV pixel to packed truecolor. */
+#define YUV_PIXEL(y, u, v) ( \
+	(CLIP(((y) + (359 * (v))) >> 8, 0x00, 0xFF) << 16) | \
+	(CLIP(((y) - (88 * (u)) - (183 * (v))) >> 8, 0x00, 0xFF) << 8) | \
+	(CLIP(((y) + (454 * (u))) >> 8, 0x00, 0xFF)))
+
+/* YUYV and UYVY rows are converted by one of the kernels below. They
+ * all use the same integer maths and must give identical output. As
+ * ((y << 8) + t) >> 8 == y + (t >> 8), the chroma terms are worked
+ * out once for each pair of pixels and added to both lumas. */
+
+void fswc_yuyv_row_c(uint8_t *ptr, int *dst, uint32_t width, int uyvy)
 {
-	uint8_t *ptr;
-	uint32_t x, y, z;
-	
-	if(src->length < (src->width * src->height * 2)) return(-1);
+	uint32_t x;
+	int y0, y1, u, v;
 	
 	/* YUYV and UYVY are very similar and so  *
 	 * are both handled by this one function. */
+	int l = (uyvy ? 1 : 0);
+	int c = l ^ 1;
+	
+	/* Each group of four bytes holds two pixels. */
+	for(x = 0; x < width; x += 2)
+	{
+		y0 = ptr[l] << 8;
+		y1 = ptr[l + 2] << 8;
+		u  = ptr[c] - 128;
+		v  = ptr[c + 2] - 128;
+		
+		*(dst++) = YUV_PIXEL(y0, u, v);
+		if(x + 1 < width) *(dst++) = YUV_PIXEL(y1, u, v);
+		
+		ptr += 4;
+	}
+}
+
+#ifdef HAVE_YUYV_SSE2
+
+/* U and V coefficients packed as two 16-bit lanes, for pmaddwd. */
+#define YUV_PAIR(u, v) ((int) (((uint32_t) (uint16_t) (v) << 16) | (uint16_t) (u)))
+
+/* 8 pixels per loop. The 16-bit lanes hold either a luma or a chroma
+ * byte, pmaddwd gives the 32-bit chroma terms for each pixel pair. */
+__attribute__((target("sse2")))
+static void fswc_yuyv_row_sse2(uint8_t *ptr, int *dst, uint32_t width, int uyvy)
+{
+	const __m128i lo   = _mm_set1_epi16(0x00FF);
+	const __m128i bias = _mm_set1_epi16(128);
+	const __m128i kr   = _mm_set1_epi32(YUV_PAIR(0, 359));
+	const __m128i kg   = _mm_set1_epi32(YUV_PAIR(-88, -183));
+	const __m128i kb   = _mm_set1_epi32(YUV_PAIR(454, 0));
+	const __m128i zero = _mm_setzero_si128();
+	uint32_t x;
+	
+	for(x = 0; x + 8 <= width; x += 8)
+	{
+		__m128i p, y, c, r, g, b, rg, bg;
+		
+		p = _mm_loadu_si128((__m128i *) ptr);
+		
+		if(uyvy) { y = _mm_srli_epi16(p, 8); c = _mm_and_si128(p, lo); }
+		else     { y = _mm_and_si128(p, lo); c = _mm_srli_epi16(p, 8); }
+		
+		/* U0 V0 U1 V1 ... */
+		c = _mm_sub_epi16(c, bias);
+		
+		r = _mm_srai_epi32(_mm_madd_epi16(c, kr), 8);
+		g = _mm_srai_epi32(_mm_madd_epi16(c, kg), 8);
+		b = _mm_srai_epi32(_mm_madd_epi16(c, kb), 8);
+		
+		/* Add each term to both pixels of its pair. */
+		rg = _mm_packs_epi32(r, g);
+		b  = _mm_packs_epi32(b, b);
+		r  = _mm_add_epi16(y, _mm_unpacklo_epi16(rg, rg));
+		g  = _mm_add_epi16(y, _mm_unpackhi_epi16(rg, rg));
+		b  = _mm_add_epi16(y, _mm_unpacklo_epi16(b, b));
+		
+		/* Clip to 0-255 and interleave as 0x00RRGGBB. */
+		rg = _mm_packus_epi16(r, g);
+		b  = _mm_packus_epi16(b, b);
+		bg = _mm_unpacklo_epi8(b, _mm_srli_si128(rg, 8));
+		r  = _mm_unpacklo_epi8(rg, zero);
+		
+		_mm_storeu_si128((__m128i *) dst, _mm_unpacklo_epi16(bg, r));
+		_mm_storeu_si128((__m128i *) (dst + 4), _mm_unpackhi_epi16(bg, r));
+		
+		ptr += 16;
+		dst += 8;
+	}
 	
-	ptr = (uint8_t *) src->img;
-	z = 0;
+	fswc_yuyv_row_c(ptr, dst, width - x, uyvy);
+}
+
+/* The SSE2 kernel on both 128-bit halves, 16 pixels per loop. */
+__attribute__((target("avx2")))
+static void fswc_yuyv_row_avx2(uint8_t *ptr, int *dst, uint32_t width, int uyvy)
+{
+	const __m256i lo   = _mm256_set1_epi16(0x00FF);
+	const __m256i bias = _mm256_set1_epi16(128);
+	const __m256i kr   = _mm256_set1_epi32(YUV_PAIR(0, 359));
+	const __m256i kg   = _mm256_set1_epi32(YUV_PAIR(-88, -183));
+	const __m256i kb   = _mm256_set1_epi32(YUV_PAIR(454, 0));
+	const __m256i zero = _mm256_setzero_si256();
+	uint32_t x;
 	
-	for(y = 0; y < src->height; y++)
+	for(x = 0; x + 16 <= width; x += 16)
 	{
-		for(x = 0; x < src->width; x++)
+		__m256i p, y, c, r, g, b, rg, bg, o0, o1;
+		
+		p = _mm256_loadu_si256((__m256i *) ptr);
+		
+		if(uyvy) { y = _mm256_srli_epi16(p, 8); c = _mm256_and_si256(p, lo); }
+		else     { y = _mm256_and_si256(p, lo); c = _mm256_srli_epi16(p, 8); }
+		
+		c = _mm256_sub_epi16(c, bias);
+		
+		r = _mm256_srai_epi32(_mm256_madd_epi16(c, kr), 8);
+		g = _mm256_srai_epi32(_mm256_madd_epi16(c, kg), 8);
+		b = _mm256_srai_epi32(_mm256_madd_epi16(c, kb), 8);
+		
+		rg = _mm256_packs_epi32(r, g);
+		b  = _mm256_packs_epi32(b, b);
+		r  = _mm256_add_epi16(y, _mm256_unpacklo_epi16(rg, rg));
+		g  = _mm256_add_epi16(y, _mm256_unpackhi_epi16(rg, rg));
+		b  = _mm256_add_epi16(y, _mm256_unpacklo_epi16(b, b));
+		
+		rg = _mm256_packus_epi16(r, g);
+		b  = _mm256_packus_epi16(b, b);
+		bg = _mm256_unpacklo_epi8(b, _mm256_srli_si256(rg, 8));
+		r  = _mm256_unpacklo_epi8(rg, zero);
+		
+		/* Each half holds pixels 0-7 and 8-15, put them in order. */
+		o0 = _mm256_unpacklo_epi16(bg, r);
+		o1 = _mm256_unpackhi_epi16(bg, r);
+		
+		_mm256_storeu_si256((__m256i *) dst, _mm256_permute2x128_si256(o0, o1, 0x20));
+		_mm256_storeu_si256((__m256i *) (dst + 8), _mm256_permute2x128_si256(o0, o1, 0x31));
+		
+		ptr += 32;
+		dst += 16;
+	}
+	
+	fswc_yuyv_row_sse2(ptr, dst, width - x, uyvy);
+}
+
+static int fswc_have_sse2(void) { return(__builtin_cpu_supports("sse2")); }
+static int fswc_have_avx2(void) { return(__builtin_cpu_supports("avx2")); }
+
+#endif
+
+#ifdef HAVE_YUYV_NEON
+
+/* 16 pixels per loop. vld4 splits the two lumas and the chroma. */
+static void fswc_yuyv_row_neon(uint8_t *ptr, int *dst, uint32_t width, int uyvy)
+{
+	const uint8x8_t bias = vdup_n_u8(128);
+	uint32_t x;
+	
+	for(x = 0; x + 16 <= width; x += 16)
+	{
+		uint8x8x4_t p = vld4_u8(ptr);
+		uint8x8x2_t r, g, b;
+		uint8x8x4_t o;
+		int16x8_t y0, y1, u, v, rt, gt, bt;
+		int i;
+		
+		if(uyvy)
+		{
+			u  = vreinterpretq_s16_u16(vsubl_u8(p.val[0], bias));
+			y0 = vreinterpretq_s16_u16(vmovl_u8(p.val[1]));
+			v  = vreinterpretq_s16_u16(vsubl_u8(p.val[2], bias));
+			y1 = vreinterpretq_s16_u16(vmovl_u8(p.val[3]));
+		}
+		else
+		{
+			y0 = vreinterpretq_s16_u16(vmovl_u8(p.val[0]));
+			u  = vreinterpretq_s16_u16(vsubl_u8(p.val[1], bias));
+			y1 = vreinterpretq_s16_u16(vmovl_u8(p.val[2]));
+			v  = vreinterpretq_s16_u16(vsubl_u8(p.val[3], bias));
+		}
+		
+		rt = vcombine_s16(
+			vshrn_n_s32(vmull_n_s16(vget_low_s16(v), 359), 8),
+			vshrn_n_s32(vmull_n_s16(vget_high_s16(v), 359), 8));
+		gt = vcombine_s16(
+			vshrn_n_s32(vmlal_n_s16(vmull_n_s16(vget_low_s16(u), -88), vget_low_s16(v), -183), 8),
+			vshrn_n_s32(vmlal_n_s16(vmull_n_s16(vget_high_s16(u), -88), vget_high_s16(v), -183), 8));
+		bt = vcombine_s16(
+			vshrn_n_s32(vmull_n_s16(vget_low_s16(u), 454), 8),
+			vshrn_n_s32(vmull_n_s16(vget_high_s16(u), 454), 8));
+		
+		/* Clip to 0-255 and put the even and odd pixels in order. */
+		r = vzip_u8(vqmovun_s16(vaddq_s16(y0, rt)), vqmovun_s16(vaddq_s16(y1, rt)));
+		g = vzip_u8(vqmovun_s16(vaddq_s16(y0, gt)), vqmovun_s16(vaddq_s16(y1, gt)));
+		b = vzip_u8(vqmovun_s16(vaddq_s16(y0, bt)), vqmovun_s16(vaddq_s16(y1, bt)));
+		
+		o.val[3] = vdup_n_u8(0);
+		for(i = 0; i < 2; i++)
 		{
-			int r, g, b;
-			int y, u, v;
-			
-			if(src->palette == SRC_PAL_UYVY)
-			{
-				if(!z) y = ptr[1] << 8;
-				else   y = ptr[3] << 8;
-				
-				u = ptr[0] - 128;
-				v = ptr[2] - 128;
-			}
-			else /* SRC_PAL_YUYV */
-			{
-				if(!z) y = ptr[0] << 8;
-				else   y = ptr[2] << 8;
-				
-				u = ptr[1] - 128;
-				v = ptr[3] - 128;
-			}
-			
-			r = (y + (359 * v)) >> 8;
-			g = (y - (88 * u) - (183 * v)) >> 8;
-			b = (y + (454 * u)) >> 8;
-			
-			*(abitmap++) += CLIP(r, 0x00, 0xFF);
-			*(abitmap++) += CLIP(g, 0x00, 0xFF);
-			*(abitmap++) += CLIP(b, 0x00, 0xFF);
-			
-			if(z++)
-			{
-				z = 0;
-				ptr += 4;
-			}
+			o.val[0] = b.val[i];
+			o.val[1] = g.val[i];
+			o.val[2] = r.val[i];
+			vst4_u8((uint8_t *) (dst + i * 8), o);
 		}
+		
+		ptr += 32;
+		dst += 16;
 	}
 	
-        return(0);
+	fswc_yuyv_row_c(ptr, dst, width - x, uyvy);
+}
+
+#endif
+
+/* The kernels, fastest first. The first one this CPU supports is used. */
+fswc_yuyv_kernel_t fswc_yuyv_kernel[] = {
+#ifdef HAVE_YUYV_NEON
+	{ "neon", fswc_yuyv_row_neon, NULL },
+#endif
+#ifdef HAVE_YUYV_SSE2
+	{ "avx2", fswc_yuyv_row_avx2, fswc_have_avx2 },
+	{ "sse2", fswc_yuyv_row_sse2, fswc_have_sse2 },
+#endif
+	{ "c",    fswc_yuyv_row_c,    NULL },
+	{ NULL, NULL, NULL }
+};
+
+static fswc_yuyv_row_t fswc_yuyv_row;
+static pthread_once_t fswc_yuyv_once = PTHREAD_ONCE_INIT;
+
+static void fswc_yuyv_select(void)
+{
+	fswc_yuyv_kernel_t *k;
+	
+	for(k = fswc_yuyv_kernel; k->row; k++)
+		if(!k->supported || k->supported()) break;
+	
+	DEBUG("Using the %s YUYV converter.", k->name);
+	fswc_yuyv_row = k->row;
 }
 
-int fswc_add_image_yuv420p(src_t *src, avgbmp_t *abitmap)
+void fswc_line_yuyv(src_t *src, uint32_t y, uint32_t x0, uint32_t w, int *dst)
 {
-	uint8_t *yptr, *uptr, *vptr;
-	uint32_t x, y, p;
+	uint8_t *ptr = (uint8_t *) src->img + y * src->width * 2;
+	int uyvy = (src->palette == SRC_PAL_UYVY);
 	
-	if(src->length < (src->width * src->height * 3) / 2) return(-1);
+	pthread_once(&fswc_yuyv_once, fswc_yuyv_select);
 	
-	/* Setup pointers to Y, U and V buffers. */
+	/* The kernels start on a pixel pair. An odd first column is
+	 * the second half of a pair, convert that one on its own. */
+	if(x0 & 1)
+	{
+		int pair[2];
+		
+		fswc_yuyv_row_c(ptr + (x0 - 1) * 2, pair, 2, uyvy);
+		*(dst++) = pair[1];
+		
+		x0++;
+		w--;
+	}
+	
+	if(w) fswc_yuyv_row(ptr + x0 * 2, dst, w, uyvy);
+}
+
+void fswc_line_yuv420p(src_t *src, uint32_t y, uint32_t x0, uint32_t w, int *dst)
+{
+	uint8_t *yptr, *uptr, *vptr;
+	uint32_t x;
+	
+	/* Setup pointers to Y, U and V buffers. The U and V
+	 * planes are shared by each pair of lines. */
 	yptr = (uint8_t *) src->img;
 	uptr = yptr + (src->width * src->height);
 	vptr = uptr + (src->width * src->height / 4);
-	p = 0;
 	
-	for(y = 0; y < src->height; y++)
+	yptr += y * src->width + x0;
+	uptr += (y / 2) * (src->width / 2);
+	vptr += (y / 2) * (src->width / 2);
+	
+	for(x = x0; x < x0 + w; x++)
 	{
-		for(x = 0; x < src->width; x++)
-		{
-			int r, g, b;
-			int y, u, v;
-			
-			y = *(yptr++) << 8;
-			u = uptr[p] - 128;
-			v = vptr[p] - 128;
-			
-			r = (y + (359 * v)) >> 8;
-			g = (y - (88 * u) - (183 * v)) >> 8;
-			b = (y + (454 * u)) >> 8;
-			
-			*(abitmap++) += CLIP(r, 0x00, 0xFF);
-			*(abitmap++) += CLIP(g, 0x00, 0xFF);
-			*(abitmap++) += CLIP(b, 0x00, 0xFF);
-			
-			if(x & 1) p++;
-		}
+		int cy, u, v;
+		
+		cy = *(yptr++) << 8;
+		u  = uptr[x >> 1] - 128;
+		v  = vptr[x >> 1] - 128;
 		
-		if(!(y & 1)) p -= src->width / 2;
+		*(dst++) = YUV_PIXEL(cy, u, v);
 	}
-	
-	return(0);
 }
 
-int fswc_add_image_nv12mb(src_t *src, avgbmp_t *abitmap)
+void fswc_line_nv12mb(src_t *src, uint32_t y, uint32_t x0, uint32_t w, int *dst)
 {
-	uint32_t x, y;
+	uint32_t x;
 	uint32_t bw;
 	
-	if(src->length != (src->width * src->height * 3) / 2) return(-1);
-	
 	bw = src->width >> 4;
 	
-	for(y = 0; y < src->height; y++)
+	for(x = x0; x < x0 + w; x++)
 	{
-		for(x = 0; x < src->width; x++)
-		{
-			uint32_t bx, by;
-			int cy, cu, cv;
-			int cr, cg, cb;
-			uint8_t *py, *puv;
-			
-			bx = x >> 4;
-			by = y >> 4;
-			
-			py  = src->img;
-			py += ((by * bw) + bx) * 0x100;
-			py += ((y - (by << 4)) * 0x10) + (x - (bx << 4));
-			
-			by /= 2;
-			
-			puv  = src->img + (src->width * src->height);
-			puv += ((by * bw) + bx) * 0x100;
-			puv += (((y / 2) - (by << 4)) * 0x10) + ((x - (bx << 4)) &~ 1);
-			
-			cy = *py << 8;
-			cu = puv[0] - 128;
-			cv = puv[1] - 128;
-			
-			cr = (cy + (359 * cv)) >> 8;
-			cg = (cy - (88 * cu) - (183 * cv)) >> 8;
-			cb = (cy + (454 * cu)) >> 8;
-			
-			*(abitmap++) += CLIP(cr, 0x00, 0xFF);
-			*(abitmap++) += CLIP(cg, 0x00, 0xFF);
-			*(abitmap++) += CLIP(cb, 0x00, 0xFF);
-		}
+		uint32_t bx, by;
+		int cy, cu, cv;
+		uint8_t *py, *puv;
+		
+		bx = x >> 4;
+		by = y >> 4;
+		
+		py  = src->img;
+		py += ((by * bw) + bx) * 0x100;
+		py += ((y - (by << 4)) * 0x10) + (x - (bx << 4));
+		
+		by /= 2;
+		
+		puv  = (uint8_t *) src->img + (src->width * src->height);
+		puv += ((by * bw) + bx) * 0x100;
+		puv += (((y / 2) - (by << 4)) * 0x10) + ((x - (bx << 4)) &~ 1);
+		
+		cy = *py << 8;
+		cu = puv[0] - 128;
+		cv = puv[1] - 128;
+		
+		*(dst++) = YUV_PIXEL(cy, cu, cv);
 	}
-	
-	return(0);
 }
 
- 
@@ -15,9 +15,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <math.h>
+#include <strings.h>
 #include <gd.h>
 #include "parse.h"
 #include "log.h"
+#include "pool.h"
+#include "fbpool.h"
 
 /* These helper macros should maybe be moved elsewhere. */
 
@@ -27,12 +31,61 @@
 #define G(c) ((c & 0xFF00) >> 8)
 #define B(c) (c & 0xFF)
 
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
 #define GREY(c) ((R(c) + G(c) + B(c)) / 3)
 #define MIX(a, b, c) (a + (((b - a) * c) / 0xFF))
 
 #define RGBMIX(c1, c2, d) \
   (RGB(MIX(R(c1), R(c2), d), MIX(G(c1), G(c2), d), MIX(B(c1), G(c2), d)))
 
+/* The effects work directly on the rows of truecolor images, as
+ * gdImageGetPixel/gdImageSetPixel are far too slow per pixel. Rows
+ * are processed four pixels at a time where that helps, using GCC
+ * vector types which become SSE2 or NEON instructions. */
+
+typedef uint32_t v4px __attribute__ ((vector_size (16)));
+
+static inline v4px px_load(int *p)
+{
+	v4px v;
+	memcpy(&v, p, sizeof(v));
+	return(v);
+}
+
+static inline void px_store(int *p, v4px v)
+{
+	memcpy(p, &v, sizeof(v));
+}
+
+/* Reverse a row in place, swapping four pixels from each end at a time. */
+static void fx_reverse_row(int *p, int w)
+{
+	const v4px rev = { 3, 2, 1, 0 };
+	int *a = p, *b = p + w - 4;
+	
+	while(b - a >= 4)
+	{
+		v4px va = px_load(a);
+		v4px vb = px_load(b);
+		
+		px_store(a, __builtin_shuffle(vb, rev));
+		px_store(b, __builtin_shuffle(va, rev));
+		
+		a += 4;
+		b -= 4;
+	}
+	
+	/* Swap what's left in the middle one at a time. */
+	for(b += 3; a < b; a++, b--)
+	{
+		int c = *a;
+		*a = *b;
+		*b = c;
+	}
+}
+
 gdImage *fx_flip(gdImage *src, char *options)
 {
 	int i;
@@ -44,68 +97,27 @@ gdImage *fx_flip(gdImage *src, char *options)
 		if(*d == 'v')
 		{
 			int y, h;
-			gdImage *line;
 			
 			MSG("Flipping image vertically.");
 			
-			line = gdImageCreateTrueColor(gdImageSX(src), 1);
-			h = gdImageSY(src) / 2;
-			
-			for(y = 0; y < h; y++)
+			/* Each row is a separate allocation, so
+			 * swapping the row pointers is enough. */
+			h = gdImageSY(src);
+			for(y = 0; y < h / 2; y++)
 			{
-				/* Copy bottom line into buffer. */
-				gdImageCopy(line, src,
-				   0, 0,
-				   0, gdImageSY(src) - y - 1,
-				   gdImageSX(src), 1);
-				
-				/* Copy the top line onto the bottom. */
-				gdImageCopy(src, src,
-				   0, gdImageSY(src) - y - 1,
-				   0, y,
-				   gdImageSX(src), 1);
-				
-				/* Copy the buffer into the top. */
-				gdImageCopy(src, line,
-				   0, y,
-				   0, 0,
-				   gdImageSX(src), 1);
+				int *line = src->tpixels[y];
+				src->tpixels[y] = src->tpixels[h - y - 1];
+				src->tpixels[h - y - 1] = line;
 			}
-			
-			gdImageDestroy(line);
 		}
 		else if(*d == 'h')
 		{
-			int x, w;
-			gdImage *line;
+			int y;
 			
 			MSG("Flipping image horizontally.");
 			
-			line = gdImageCreateTrueColor(1, gdImageSY(src));
-			w = gdImageSX(src) / 2;
-			
-			for(x = 0; x < w; x++)
-			{
-				/* Copy right line into buffer. */
-				gdImageCopy(line, src,
-				   0, 0,
-				   gdImageSX(src) - x - 1, 0,
-				   1, gdImageSY(src));
-				
-				/* Copy the left line onto the right. */
-				gdImageCopy(src, src,
-				   gdImageSX(src) - x - 1, 0,
-				   x, 0,
-				   1, gdImageSY(src));
-				
-				/* Copy the buffer into the left. */
-				gdImageCopy(src, line,
-				   x, 0,
-				   0, 0,
-				   1, gdImageSY(src));
-			}
-			
-			gdImageDestroy(line);
+			for(y = 0; y < gdImageSY(src); y++)
+				fx_reverse_row(src->tpixels[y], gdImageSX(src));
 		}
 		else WARN("Unknown flip direction: %s", d);
 	}
@@ -113,56 +125,63 @@ gdImage *fx_flip(gdImage *src, char *options)
 	return(src);
 }
 
-gdImage *fx_crop(gdImage *src, char *options)
+/* Work out the area --crop selects from a sw x sh image. Returns 0
+ * on success, -1 if the options are invalid or -2 if the area is
+ * larger than the image. */
+int fx_crop_area(int sw, int sh, char *options, int *x, int *y, int *w, int *h)
 {
 	char arg[32];
-	int w, h, x, y;
-	gdImage *im;
 	
-	if(argncpy(arg, 32, options, ", \t", 0, 0))
-	{
-		WARN("Invalid area to crop: %s", arg);
-		return(src);
-	}
+	if(argncpy(arg, 32, options, ", \t", 0, 0)) return(-1);
 	
-	w = argtol(arg, "x ", 0, 0, 10);
-	h = argtol(arg, "x ", 1, 0, 10);
+	*w = argtol(arg, "x ", 0, 0, 10);
+	*h = argtol(arg, "x ", 1, 0, 10);
 	
-	if(w < 0 || h < 0)
-	{
-		WARN("Invalid area to crop: %s", arg);
-		return(src);
-	}
+	if(*w < 0 || *h < 0) return(-1);
 	
 	/* Make sure crop area resolution is smaller than the source image. */
-	if(w > gdImageSX(src) ||
-	   h > gdImageSY(src))
-	{
-		WARN("Crop area is larger than the image!");
-		return(src);
-	}
+	if(*w > sw || *h > sh) return(-2);
 	
 	/* Get the offset. */
-	x = -1;
-	y = -1;
+	*x = -1;
+	*y = -1;
 	
 	if(!argncpy(arg, 32, options, ", \t", 1, 0))
 	{
-		x = argtol(arg, "x ", 0, 0, 10);
-		y = argtol(arg, "x ", 1, 0, 10);
+		*x = argtol(arg, "x ", 0, 0, 10);
+		*y = argtol(arg, "x ", 1, 0, 10);
 	}
 	
-	if(x < 0 || y < 0)
+	if(*x < 0 || *y < 0)
 	{
 		/* By default crop the center of the image. */
-		x = (gdImageSX(src) - w) / 2;
-		y = (gdImageSY(src) - h) / 2;
+		*x = (sw - *w) / 2;
+		*y = (sh - *h) / 2;
+	}
+	
+	return(0);
+}
+
+gdImage *fx_crop(gdImage *src, char *options)
+{
+	int w, h, x, y;
+	gdImage *im;
+	
+	switch(fx_crop_area(gdImageSX(src), gdImageSY(src), options,
+	                    &x, &y, &w, &h))
+	{
+	case -1:
+		WARN("Invalid area to crop: %s", options);
+		return(src);
+	case -2:
+		WARN("Crop area is larger than the image!");
+		return(src);
 	}
 	
 	MSG("Cropping image from %ix%i [offset: %ix%i] -> %ix%i.",
 	    gdImageSX(src), gdImageSY(src), x, y, w, h);
 	
-	im = gdImageCreateTrueColor(w, h);
+	im = fbpool_image(w, h);
 	if(!im)
 	{
 		WARN("Out of memory.");
@@ -171,46 +190,421 @@ gdImage *fx_crop(gdImage *src, char *options)
 	
 	gdImageCopy(im, src, 0, 0, x, y, w, h);
 	
-	gdImageDestroy(src);
+	fbpool_release(src);
 	
 	return(im);
 }
 
+/* fx_scale resamples the image in two passes, first each row and then
+ * each column. For every output pixel there's a table entry with
+ * the first source pixel and a list of fixed point weights. */
+
+#define FX_SCALE_BITS (14)
+#define FX_SCALE_ONE  (1 << FX_SCALE_BITS)
+
+typedef int32_t v4si __attribute__ ((vector_size (16)));
+typedef uint8_t v4qu __attribute__ ((vector_size (4)));
+
+typedef struct {
+	char *name;
+	double support;
+	double (*fn)(double x);
+} fx_filter_t;
+
+typedef struct {
+	int size;   /* Number of output pixels */
+	int taps;   /* Weights stored for each output pixel */
+	int *first; /* First source pixel for each output pixel */
+	int *count; /* Number of source pixels used */
+	int *weight;
+} fx_weights_t;
+
+typedef struct {
+	gdImage *src;
+	gdImage *dst;
+	fx_weights_t wx;
+	fx_weights_t wy;
+	int **rows; /* Horizontally scaled source rows */
+	int bands;
+	volatile int error;
+} fx_scale_t;
+
+static double fx_box(double x)
+{
+	return(x > -0.5 && x <= 0.5 ? 1.0 : 0.0);
+}
+
+static double fx_bilinear(double x)
+{
+	if(x < 0.0) x = -x;
+	return(x < 1.0 ? 1.0 - x : 0.0);
+}
+
+static double fx_sinc(double x)
+{
+	if(x == 0.0) return(1.0);
+	x *= M_PI;
+	return(sin(x) / x);
+}
+
+static double fx_lanczos(double x)
+{
+	if(x > -3.0 && x < 3.0) return(fx_sinc(x) * fx_sinc(x / 3.0));
+	return(0.0);
+}
+
+static fx_filter_t fx_filter[] = {
+	{ "box",      0.5, fx_box      },
+	{ "bilinear", 1.0, fx_bilinear },
+	{ "lanczos",  3.0, fx_lanczos  },
+	{ NULL, 0, NULL }
+};
+
+static void fx_free_weights(fx_weights_t *w)
+{
+	free(w->first);
+	free(w->count);
+	free(w->weight);
+}
+
+static int fx_make_weights(fx_weights_t *w, fx_filter_t *f, int in, int out)
+{
+	double scale = (double) in / out;
+	double fscale = (scale < 1.0 ? 1.0 : scale);
+	double support = f->support * fscale;
+	double *k;
+	int i, j;
+	
+	w->size   = out;
+	w->taps   = (int) ceil(support) * 2 + 1;
+	w->first  = malloc(out * sizeof(int));
+	w->count  = malloc(out * sizeof(int));
+	w->weight = calloc(out * w->taps, sizeof(int));
+	k = malloc(w->taps * sizeof(double));
+	
+	if(!w->first || !w->count || !w->weight || !k)
+	{
+		fx_free_weights(w);
+		free(k);
+		return(-1);
+	}
+	
+	for(i = 0; i < out; i++)
+	{
+		double centre = (i + 0.5) * scale;
+		double total = 0;
+		int first, count, sum, big;
+		int *iw = w->weight + i * w->taps;
+		
+		if(f->fn == fx_box)
+		{
+			/* Each source pixel is weighted by how much of it the
+			 * output pixel covers, as in gdImageCopyResampled(). */
+			double x0 = i * scale, x1 = (i + 1) * scale;
+			
+			first = (int) x0;
+			count = (int) ceil(x1);
+			if(count > in) count = in;
+			count -= first;
+			if(count > w->taps) count = w->taps;
+			
+			for(j = 0; j < count; j++)
+			{
+				k[j] = MIN(x1, first + j + 1) - MAX(x0, first + j);
+				total += k[j];
+			}
+		}
+		else
+		{
+			first = (int) (centre - support + 0.5);
+			if(first < 0) first = 0;
+			
+			count = (int) (centre + support + 0.5);
+			if(count > in) count = in;
+			count -= first;
+			if(count > w->taps) count = w->taps;
+			
+			for(j = 0; j < count; j++)
+			{
+				k[j] = f->fn((j + first - centre + 0.5) / fscale);
+				total += k[j];
+			}
+		}
+		
+		/* Convert to fixed point. Any rounding error goes on the
+		 * largest weight, so the weights always add up to one. */
+		for(sum = 0, big = 0, j = 0; j < count; j++)
+		{
+			iw[j] = (int) floor(k[j] / total * FX_SCALE_ONE + 0.5);
+			sum += iw[j];
+			if(iw[j] > iw[big]) big = j;
+		}
+		
+		iw[big] += FX_SCALE_ONE - sum;
+		
+		w->first[i] = first;
+		w->count[i] = count;
+	}
+	
+	free(k);
+	
+	return(0);
+}
+
+/* Pixels are handled as four 32-bit lanes, one per byte. Working
+ * on the bytes in memory order means the code doesn't depend on the
+ * byte order, the alpha byte is simply scaled along with the rest. */
+static inline v4si fx_unpack(int *p)
+{
+	v4qu b;
+	memcpy(&b, p, sizeof(b));
+	return(__builtin_convertvector(b, v4si));
+}
+
+static inline void fx_pack(int *p, v4si v)
+{
+	v4qu b;
+	
+	/* Round, then clip to 0-255. */
+	v = (v + (FX_SCALE_ONE >> 1)) >> FX_SCALE_BITS;
+	v &= ~(v < 0);
+	v = (v & ~(v > 0xFF)) | (0xFF & (v > 0xFF));
+	
+	b = __builtin_convertvector(v, v4qu);
+	memcpy(p, &b, sizeof(b));
+}
+
+static void fx_scale_rows(void *arg, int part)
+{
+	fx_scale_t *s = (fx_scale_t *) arg;
+	int y0 = (int64_t) gdImageSY(s->src) * part / s->bands;
+	int y1 = (int64_t) gdImageSY(s->src) * (part + 1) / s->bands;
+	int x, y, j;
+	
+	for(y = y0; y < y1; y++)
+	{
+		int *src = s->src->tpixels[y];
+		int *dst = s->rows[y];
+		
+		for(x = 0; x < s->wx.size; x++)
+		{
+			int *p = src + s->wx.first[x];
+			int *w = s->wx.weight + x * s->wx.taps;
+			v4si acc = { 0, 0, 0, 0 };
+			
+			for(j = 0; j < s->wx.count[x]; j++)
+				acc += fx_unpack(p + j) * w[j];
+			
+			fx_pack(dst + x, acc);
+		}
+	}
+}
+
+static void fx_scale_columns(void *arg, int part)
+{
+	fx_scale_t *s = (fx_scale_t *) arg;
+	int y0 = (int64_t) gdImageSY(s->dst) * part / s->bands;
+	int y1 = (int64_t) gdImageSY(s->dst) * (part + 1) / s->bands;
+	int w = gdImageSX(s->dst);
+	int x, y, j;
+	v4si *acc;
+	
+	acc = malloc(w * sizeof(v4si));
+	if(!acc)
+	{
+		s->error = 1;
+		return;
+	}
+	
+	/* Accumulate whole rows at a time, reading along the rows. */
+	for(y = y0; y < y1; y++)
+	{
+		int first = s->wy.first[y];
+		int *wy = s->wy.weight + y * s->wy.taps;
+		
+		memset(acc, 0, w * sizeof(v4si));
+		
+		for(j = 0; j < s->wy.count[y]; j++)
+		{
+			int *p = s->rows[first + j];
+			int k = wy[j];
+			
+			for(x = 0; x < w; x++) acc[x] += fx_unpack(p + x) * k;
+		}
+		
+		for(x = 0; x < w; x++) fx_pack(s->dst->tpixels[y] + x, acc[x]);
+	}
+	
+	free(acc);
+}
+
+/* Integer downscales with the box filter just average each block
+ * of fx by fy pixels. */
+static void fx_scale_blocks(void *arg, int part)
+{
+	fx_scale_t *s = (fx_scale_t *) arg;
+	int y0 = (int64_t) gdImageSY(s->dst) * part / s->bands;
+	int y1 = (int64_t) gdImageSY(s->dst) * (part + 1) / s->bands;
+	int w = gdImageSX(s->dst);
+	int fx = gdImageSX(s->src) / w;
+	int fy = gdImageSY(s->src) / gdImageSY(s->dst);
+	int n = fx * fy;
+	int x, y, i, j;
+	v4si *acc;
+	
+	acc = malloc(w * sizeof(v4si));
+	if(!acc)
+	{
+		s->error = 1;
+		return;
+	}
+	
+	for(y = y0; y < y1; y++)
+	{
+		memset(acc, 0, w * sizeof(v4si));
+		
+		for(j = 0; j < fy; j++)
+		{
+			int *p = s->src->tpixels[y * fy + j];
+			
+			for(x = 0; x < w; x++)
+				for(i = 0; i < fx; i++)
+					acc[x] += fx_unpack(p++);
+		}
+		
+		/* Divide with rounding before going to fixed point, the
+		 * sum of a big block times ONE would overflow. */
+		for(x = 0; x < w; x++)
+			fx_pack(s->dst->tpixels[y] + x,
+			        ((acc[x] + n / 2) / n) << FX_SCALE_BITS);
+	}
+	
+	free(acc);
+}
+
 gdImage *fx_scale(gdImage *src, char *options)
 {
+	char name[32];
+	fx_filter_t *f;
+	fx_scale_t s;
 	int w, h;
-	gdImage *im;
 	
 	w = argtol(options, "x ", 0, 0, 10);
 	h = argtol(options, "x ", 1, 0, 10);
 	
-	if(w < 0 || h < 0)
+	if(w < 1 || h < 1)
 	{
 		WARN("Invalid resolution: %s", options);
 		return(src);
 	}
 	
-	MSG("Scaling image from %ix%i -> %ix%i.",
-	    gdImageSX(src), gdImageSY(src), w, h);
+	/* The filter is optional, the default is box. */
+	if(argncpy(name, 32, options, ", \t", 1, 0)) strcpy(name, "box");
 	
-	im = gdImageCreateTrueColor(w, h);
-	if(!im)
+	for(f = fx_filter; f->name; f++)
+		if(!strcasecmp(f->name, name)) break;
+	
+	if(!f->name)
+	{
+		WARN("Unknown scaling filter: %s", name);
+		return(src);
+	}
+	
+	/* The decoder may already have produced the right size. */
+	if(gdImageSX(src) == w && gdImageSY(src) == h) return(src);
+	
+	MSG("Scaling image from %ix%i -> %ix%i (%s).",
+	    gdImageSX(src), gdImageSY(src), w, h, f->name);
+	
+	memset(&s, 0, sizeof(s));
+	s.src = src;
+	s.dst = fbpool_image(w, h);
+	if(!s.dst)
+	{
+		WARN("Out of memory.");
+		return(src);
+	}
+	
+	s.bands = pool_threads();
+	if(s.bands > h) s.bands = h;
+	
+	if(f->fn == fx_box &&
+	   gdImageSX(src) % w == 0 && gdImageSY(src) % h == 0)
+	{
+		pool_run(s.bands, fx_scale_blocks, &s);
+	}
+	else if(fx_make_weights(&s.wx, f, gdImageSX(src), w) ||
+	        fx_make_weights(&s.wy, f, gdImageSY(src), h))
+	{
+		s.error = 1;
+	}
+	else
+	{
+		/* Scale the rows into a temporary image, then the columns
+		 * of that into the final one. */
+		gdImage *tmp = fbpool_image(w, gdImageSY(src));
+		
+		if(tmp)
+		{
+			s.rows = tmp->tpixels;
+			
+			s.bands = MIN(pool_threads(), gdImageSY(src));
+			pool_run(s.bands, fx_scale_rows, &s);
+			
+			s.bands = MIN(pool_threads(), h);
+			pool_run(s.bands, fx_scale_columns, &s);
+			
+			fbpool_release(tmp);
+		}
+		else s.error = 1;
+	}
+	
+	fx_free_weights(&s.wx);
+	fx_free_weights(&s.wy);
+	
+	if(s.error)
 	{
 		WARN("Out of memory.");
+		fbpool_release(s.dst);
 		return(src);
 	}
 	
-	gdImageCopyResampled(im, src, 0, 0, 0, 0,
-	   w, h, gdImageSX(src), gdImageSY(src));
+	fbpool_release(src);
 	
-	gdImageDestroy(src);
+	return(s.dst);
+}
+
+/* Size of the square tiles used by the rotations. 16 rows of 16
+ * pixels are read and written at a time, so both images stay in
+ * the cache rather than missing on every write down a column. */
+#define FX_TILE (16)
+
+static void fx_rotate_180(gdImage *src)
+{
+	int w = gdImageSX(src), h = gdImageSY(src);
+	int x, y;
 	
-	return(im);
+	/* Swap each row in the top half with its mirror image in
+	 * the bottom half. The middle row of an odd height image is
+	 * reversed with itself. */
+	for(y = 0; y < (h + 1) / 2; y++)
+	{
+		int *a = src->tpixels[y];
+		int *b = src->tpixels[h - y - 1];
+		int n = (a == b ? w / 2 : w);
+		
+		for(x = 0; x < n; x++)
+		{
+			int c = a[x];
+			a[x] = b[w - x - 1];
+			b[w - x - 1] = c;
+		}
+	}
 }
 
 gdImage *fx_rotate(gdImage *src, char *options)
 {
-	int x, y;
+	int x, y, tx, ty;
 	gdImage *im;
 	int angle = atoi(options);
 	
@@ -228,10 +622,11 @@ gdImage *fx_rotate(gdImage *src, char *options)
 		return(src);
 	}
 	
-	/* 180 can be done with two flips. */
+	/* 180 can be done in place. */
 	if(angle == 180)
 	{
-		fx_flip(src, "h,v");
+		MSG("Rotating image 180 degrees.");
+		fx_rotate_180(src);
 		return(src);
 	}
 	
@@ -240,29 +635,39 @@ gdImage *fx_rotate(gdImage *src, char *options)
 	    gdImageSY(src), gdImageSX(src));
 	
 	/* Create rotated image. */
-	im = gdImageCreateTrueColor(gdImageSY(src), gdImageSX(src));
+	im = fbpool_image(gdImageSY(src), gdImageSX(src));
 	if(!im)
 	{
 		WARN("Out of memory.");
 		return(src);
 	}
 	
-	for(y = 0; y < gdImageSY(src); y++)
-		for(x = 0; x < gdImageSX(src); x++)
+	for(ty = 0; ty < gdImageSY(src); ty += FX_TILE)
+		for(tx = 0; tx < gdImageSX(src); tx += FX_TILE)
 		{
-			int c = gdImageGetPixel(src, x, y);
+			int ey = MIN(ty + FX_TILE, gdImageSY(src));
+			int ex = MIN(tx + FX_TILE, gdImageSX(src));
 			
-			if(angle == 90)
+			for(y = ty; y < ey; y++)
 			{
-				gdImageSetPixel(im, gdImageSX(im) - y - 1, x, c);
-			}
-			else
-			{
-				gdImageSetPixel(im, y, gdImageSY(im) - x - 1, c);
+				int *s = src->tpixels[y];
+				
+				if(angle == 90)
+				{
+					int dx = gdImageSX(im) - y - 1;
+					for(x = tx; x < ex; x++)
+						im->tpixels[x][dx] = s[x];
+				}
+				else
+				{
+					int dy = gdImageSY(im) - 1;
+					for(x = tx; x < ex; x++)
+						im->tpixels[dy - x][y] = s[x];
+				}
 			}
 		}
 	
-	gdImageDestroy(src);
+	fbpool_release(src);
 	
 	return(im);
 }
@@ -282,22 +687,24 @@ gdImage *fx_deinterlace(gdImage *src, char *options)
 	
 	for(y = 1; y < gdImageSY(src) - 1; y += 2)
 	{
+		int *p  = src->tpixels[y];
+		int *pu = src->tpixels[y - 1];
+		int *pd = src->tpixels[y + 1];
+		
 		for(x = 0; x < gdImageSX(src); x++)
 		{
 			int c, cu, cd, d;
 			
-			c  = gdImageGetPixel(src, x, y);
-			cu = gdImageGetPixel(src, x, y - 1);
-			cd = gdImageGetPixel(src, x, y + 1);
+			c  = p[x];
+			cu = pu[x];
+			cd = pd[x];
 			
 			/* Calculate the difference of the pixel (x,y) from
 			 * the average of it's neighbours above and below. */
 			d = 0xFF - abs(GREY(cu) - GREY(cd));
 			d = (abs(GREY(cu) - (0xFF - GREY(c)) - GREY(cd)) * d) / 0xFF;
 			
-			c = RGBMIX(c, RGBMIX(cu, cd, 128), d);
-			
-			gdImageSetPixel(src, x, y, c);
+			p[x] = RGBMIX(c, RGBMIX(cu, cd, 128), d);
 		}
 	}
 	
@@ -310,13 +717,17 @@ gdImage *fx_invert(gdImage *src, char *options)
 	
 	MSG("Inverting image.");
 	
+	/* Overwrite each pixel with a negative of its value. For
+	 * opaque pixels 0xFFFFFF - c is the same as c ^ 0xFFFFFF. */
 	for(y = 0; y < gdImageSY(src); y++)
-		for(x = 0; x < gdImageSX(src); x++)
-		{
-			/* Overwrite the pixel with a negative of its value. */
-			gdImageSetPixel(src, x, y,
-			   0xFFFFFF - gdImageGetPixel(src, x, y));
-		}
+	{
+		int *p = src->tpixels[y];
+		
+		for(x = 0; x + 4 <= gdImageSX(src); x += 4)
+			px_store(p + x, px_load(p + x) ^ 0xFFFFFF);
+		
+		for(; x < gdImageSX(src); x++) p[x] ^= 0xFFFFFF;
+	}
 	
 	return(src);
 }
@@ -328,18 +739,31 @@ gdImage *fx_greyscale(gdImage *src, char *options)
 	MSG("Greyscaling image.");
 	
 	for(y = 0; y < gdImageSY(src); y++)
-		for(x = 0; x < gdImageSX(src); x++)
+	{
+		int *p = src->tpixels[y];
+		
+		for(x = 0; x + 4 <= gdImageSX(src); x += 4)
+		{
+			v4px c = px_load(p + x);
+			
+			c = (((c >> 16) & 0xFF) + ((c >> 8) & 0xFF) + (c & 0xFF)) / 3;
+			px_store(p + x, (c << 16) | (c << 8) | c);
+		}
+		
+		for(; x < gdImageSX(src); x++)
 		{
-			uint8_t c = GREY(gdImageGetPixel(src, x, y));
-			gdImageSetPixel(src, x, y, RGB(c, c, c));
+			uint8_t c = GREY(p[x]);
+			p[x] = RGB(c, c, c);
 		}
+	}
 	
 	return(src);
 }
 
 gdImage *fx_swapchannels(gdImage *src, char *options)
 {
-	int mode;
+	uint32_t m, k;
+	int mode, s;
 	int x, y;
 	
 	if(strlen(options) != 2)
@@ -366,17 +790,28 @@ gdImage *fx_swapchannels(gdImage *src, char *options)
 	MSG("Swapping colour channels %c <> %c",
 		toupper(options[0]), toupper(options[1]));
 	
+	/* Each swap moves two channels towards each other by the same
+	 * distance and leaves the third where it is. */
+	if(mode == 1)      { m = 0xFF0000; k = 0x0000FF; s = 8;  }
+	else if(mode == 2) { m = 0xFF0000; k = 0x00FF00; s = 16; }
+	else               { m = 0x00FF00; k = 0xFF0000; s = 8;  }
+	
 	for(y = 0; y < gdImageSY(src); y++)
-		for(x = 0; x < gdImageSX(src); x++)
+	{
+		int *p = src->tpixels[y];
+		
+		for(x = 0; x + 4 <= gdImageSX(src); x += 4)
 		{
-			int c = gdImageGetPixel(src, x, y);
-			
-			if(mode == 1) c = RGB(G(c), R(c), B(c));
-			else if(mode == 2) c = RGB(B(c), G(c), R(c));
-			else if(mode == 3) c = RGB(R(c), B(c), G(c));
-			
-			gdImageSetPixel(src, x, y, c);
+			v4px c = px_load(p + x);
+			px_store(p + x, (c & k) | ((c & m) >> s) | ((c << s) & m));
 		}
+		
+		for(; x < gdImageSX(src); x++)
+		{
+			uint32_t c = p[x];
+			p[x] = (c & k) | ((c & m) >> s) | ((c << s) & m);
+		}
+	}
 	
 	return(src);
 }
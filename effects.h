@@ -11,6 +11,7 @@
 #define INC_EFFECTS_H
 
 extern gdImage *fx_flip(gdImage *src, char *options);
+extern int fx_crop_area(int sw, int sh, char *options, int *x, int *y, int *w, int *h);
 extern gdImage *fx_crop(gdImage *src, char *options);
 extern gdImage *fx_scale(gdImage *src, char *options);
 extern gdImage *fx_rotate(gdImage *src, char *options);
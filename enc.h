@@ -0,0 +1,54 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2011 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+#ifndef INC_ENC_H
+#define INC_ENC_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <gd.h>
+
+#define ENC_SUBSAMPLE_AUTO (-1)
+#define ENC_SUBSAMPLE_444 (0)
+#define ENC_SUBSAMPLE_422 (1)
+#define ENC_SUBSAMPLE_420 (2)
+
+#define ENC_DCT_ISLOW (0)
+#define ENC_DCT_IFAST (1)
+#define ENC_DCT_FLOAT (2)
+
+/* JPEG encoder settings. The defaults give the same output as
+ * gdImageJpeg, which only subsamples below quality 90. */
+typedef struct {
+	int quality;     /* 0 - 100, or -1 for the libjpeg default */
+	int subsample;   /* ENC_SUBSAMPLE_* */
+	int optimize;    /* Optimise the Huffman tables */
+	int progressive;
+	int dct;         /* ENC_DCT_* */
+	int restart;     /* Restart interval in MCU rows, 0 for none */
+	int slices;      /* Encode in parallel slices, 0 for one per thread */
+} fswc_jpeg_opts_t;
+
+extern void fswc_jpeg_defaults(fswc_jpeg_opts_t *opts);
+extern int fswc_jpeg_subsample(fswc_jpeg_opts_t *opts, char *value);
+extern int fswc_jpeg_dct(fswc_jpeg_opts_t *opts, char *value);
+
+/* Compress the image into buf, which holds size bytes, and return the
+ * length in len. buf may be NULL. If the image doesn't fit, buf is
+ * replaced with a larger buffer and size updated. Either way buf is
+ * freed by the caller. Returns 0 on success, -1 on error. */
+extern int fswc_encode_jpeg_mem(gdImage *im, fswc_jpeg_opts_t *opts,
+                                uint8_t **buf, unsigned long *len,
+                                unsigned long *size);
+
+#endif
+
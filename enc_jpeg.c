@@ -0,0 +1,446 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2011 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <strings.h>
+#include <setjmp.h>
+#include <gd.h>
+#include <jpeglib.h>
+#include "enc.h"
+#include "log.h"
+#include "pool.h"
+
+/* With libjpeg-turbo the rows of gdImage->tpixels can be passed to
+ * the encoder as they are, the alpha byte is simply ignored. */
+#if defined(JCS_EXTENSIONS) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define FSWC_ENC_DIRECT
+#define FSWC_ENC_SPACE (JCS_EXT_BGRX)
+#elif defined(JCS_EXTENSIONS)
+#define FSWC_ENC_DIRECT
+#define FSWC_ENC_SPACE (JCS_EXT_XRGB)
+#endif
+
+typedef struct {
+	struct jpeg_error_mgr pub;
+	jmp_buf env;
+} fswc_enc_error_t;
+
+static void fswc_enc_error_exit(j_common_ptr cinfo)
+{
+	fswc_enc_error_t *err = (fswc_enc_error_t *) cinfo->err;
+	char msg[JMSG_LENGTH_MAX];
+	
+	cinfo->err->format_message(cinfo, msg);
+	ERROR("Error encoding JPEG image: %s", msg);
+	
+	longjmp(err->env, 1);
+}
+
+void fswc_jpeg_defaults(fswc_jpeg_opts_t *opts)
+{
+	memset(opts, 0, sizeof(fswc_jpeg_opts_t));
+	opts->quality   = -1;
+	opts->subsample = ENC_SUBSAMPLE_AUTO;
+	opts->dct       = ENC_DCT_ISLOW;
+	opts->slices    = 1;
+}
+
+int fswc_jpeg_subsample(fswc_jpeg_opts_t *opts, char *value)
+{
+	if(!strcmp(value, "auto")) opts->subsample = ENC_SUBSAMPLE_AUTO;
+	else if(!strcmp(value, "444")) opts->subsample = ENC_SUBSAMPLE_444;
+	else if(!strcmp(value, "422")) opts->subsample = ENC_SUBSAMPLE_422;
+	else if(!strcmp(value, "420")) opts->subsample = ENC_SUBSAMPLE_420;
+	else
+	{
+		ERROR("Unknown chroma subsampling: %s", value);
+		return(-1);
+	}
+	
+	return(0);
+}
+
+int fswc_jpeg_dct(fswc_jpeg_opts_t *opts, char *value)
+{
+	if(!strcasecmp(value, "islow")) opts->dct = ENC_DCT_ISLOW;
+	else if(!strcasecmp(value, "ifast")) opts->dct = ENC_DCT_IFAST;
+	else if(!strcasecmp(value, "float")) opts->dct = ENC_DCT_FLOAT;
+	else
+	{
+		ERROR("Unknown DCT method: %s", value);
+		return(-1);
+	}
+	
+	return(0);
+}
+
+/* Resolve the automatic subsampling the same way as gd. */
+static int fswc_enc_subsample(fswc_jpeg_opts_t *opts)
+{
+	if(opts->subsample != ENC_SUBSAMPLE_AUTO) return(opts->subsample);
+	return(opts->quality >= 90 ? ENC_SUBSAMPLE_444 : ENC_SUBSAMPLE_420);
+}
+
+static void fswc_enc_setup(struct jpeg_compress_struct *cinfo,
+                           gdImage *im, int height, fswc_jpeg_opts_t *opts)
+{
+	cinfo->image_width  = gdImageSX(im);
+	cinfo->image_height = height;
+#ifdef FSWC_ENC_DIRECT
+	cinfo->input_components = 4;
+	cinfo->in_color_space   = FSWC_ENC_SPACE;
+#else
+	cinfo->input_components = 3;
+	cinfo->in_color_space   = JCS_RGB;
+#endif
+	
+	jpeg_set_defaults(cinfo);
+	if(opts->quality >= 0) jpeg_set_quality(cinfo, opts->quality, TRUE);
+	
+	/* Luma sampling factors, the chroma components stay at 1x1. */
+	switch(fswc_enc_subsample(opts))
+	{
+	case ENC_SUBSAMPLE_444:
+		cinfo->comp_info[0].h_samp_factor = 1;
+		cinfo->comp_info[0].v_samp_factor = 1;
+		break;
+	case ENC_SUBSAMPLE_422:
+		cinfo->comp_info[0].h_samp_factor = 2;
+		cinfo->comp_info[0].v_samp_factor = 1;
+		break;
+	default:
+		cinfo->comp_info[0].h_samp_factor = 2;
+		cinfo->comp_info[0].v_samp_factor = 2;
+		break;
+	}
+	
+	switch(opts->dct)
+	{
+	case ENC_DCT_IFAST: cinfo->dct_method = JDCT_IFAST; break;
+	case ENC_DCT_FLOAT: cinfo->dct_method = JDCT_FLOAT; break;
+	default:            cinfo->dct_method = JDCT_ISLOW; break;
+	}
+	
+	cinfo->optimize_coding = (opts->optimize ? TRUE : FALSE);
+	cinfo->restart_in_rows = opts->restart;
+	
+	if(opts->progressive) jpeg_simple_progression(cinfo);
+}
+
+/* Compress h rows of the image starting at row y into buf, which
+ * holds size bytes. libjpeg replaces it with a larger buffer if the
+ * image doesn't fit. The length is returned in len. A non-zero
+ * interval sets the restart interval in MCUs. Returns 0 on success,
+ * -1 on error. */
+static int fswc_enc_rows(uint8_t **buf, unsigned long *len,
+                         unsigned long *size, gdImage *im, int y, int h,
+                         fswc_jpeg_opts_t *opts, unsigned int interval)
+{
+	struct jpeg_compress_struct cinfo;
+	fswc_enc_error_t jerr;
+	JSAMPLE *volatile row = NULL;
+	uint8_t *old = *buf;
+	
+	cinfo.err = jpeg_std_error(&jerr.pub);
+	jerr.pub.error_exit = fswc_enc_error_exit;
+	
+	if(setjmp(jerr.env))
+	{
+		jpeg_destroy_compress(&cinfo);
+		if(*buf != old) free(*buf);
+		*buf = old;
+		*len = 0;
+		free(row);
+		return(-1);
+	}
+	
+	*len = (old ? *size : 0);
+	
+	jpeg_create_compress(&cinfo);
+	jpeg_mem_dest(&cinfo, buf, len);
+	
+	fswc_enc_setup(&cinfo, im, h, opts);
+	
+	if(interval)
+	{
+		cinfo.restart_interval = interval;
+		cinfo.restart_in_rows  = 0;
+	}
+	
+#ifndef FSWC_ENC_DIRECT
+	row = malloc(gdImageSX(im) * 3);
+	if(!row)
+	{
+		ERROR("Out of memory.");
+		longjmp(jerr.env, 1);
+	}
+#endif
+	
+	jpeg_start_compress(&cinfo, TRUE);
+	
+	while(cinfo.next_scanline < cinfo.image_height)
+	{
+		int *src = im->tpixels[y + cinfo.next_scanline];
+		JSAMPROW p;
+	
+#ifdef FSWC_ENC_DIRECT
+		p = (JSAMPROW) src;
+#else
+		int x;
+		
+		for(p = row, x = 0; x < gdImageSX(im); x++)
+		{
+			*(p++) = (src[x] >> 16) & 0xFF;
+			*(p++) = (src[x] >> 8) & 0xFF;
+			*(p++) = src[x] & 0xFF;
+		}
+		
+		p = row;
+#endif
+		
+		jpeg_write_scanlines(&cinfo, &p, 1);
+	}
+	
+	jpeg_finish_compress(&cinfo);
+	jpeg_destroy_compress(&cinfo);
+	
+	/* The size of a buffer from libjpeg is only known to be enough
+	 * for this image. */
+	if(*buf != old)
+	{
+		free(old);
+		*size = *len;
+	}
+	
+	free(row);
+	
+	return(0);
+}
+
+/* Sliced encoding. The image is cut into horizontal slices of whole
+ * restart intervals, each is compressed as a separate JPEG on the
+ * thread pool. As a restart marker resets the encoder to the same
+ * state as the start of an image, the scan data of the slices can be
+ * joined with RST markers into one baseline JPEG. This needs the same
+ * tables in every slice, so not with optimised Huffman tables. */
+
+typedef struct {
+	gdImage *im;
+	fswc_jpeg_opts_t *opts;
+	int rows;              /* Image rows in each slice */
+	unsigned int interval; /* Restart interval in MCUs */
+	uint8_t **buf;
+	unsigned long *len;
+	volatile int error;
+} fswc_slices_t;
+
+static void fswc_enc_slice(void *arg, int part)
+{
+	fswc_slices_t *s = (fswc_slices_t *) arg;
+	int y = part * s->rows;
+	int h = gdImageSY(s->im) - y;
+	unsigned long size = 0;
+	
+	if(h > s->rows) h = s->rows;
+	
+	if(fswc_enc_rows(&s->buf[part], &s->len[part], &size, s->im, y, h,
+	                 s->opts, s->interval)) s->error = 1;
+}
+
+/* Find the start of the scan data, just after the SOS segment. The
+ * scan must run to an EOI at the very end. Returns 0 on success. */
+static int fswc_enc_scan(uint8_t *buf, unsigned long len, unsigned long *start)
+{
+	unsigned long i;
+	
+	if(len < 4 || buf[len - 2] != 0xFF || buf[len - 1] != 0xD9)
+		return(-1);
+	
+	for(i = 2; i + 4 <= len; i += 2 + ((buf[i + 2] << 8) | buf[i + 3]))
+	{
+		if(buf[i] != 0xFF) return(-1);
+		if(buf[i + 1] != 0xDA) continue;
+		
+		*start = i + 2 + ((buf[i + 2] << 8) | buf[i + 3]);
+		return(*start <= len - 2 ? 0 : -1);
+	}
+	
+	return(-1);
+}
+
+/* Set the image height in the SOF segment of the headers. */
+static int fswc_enc_height(uint8_t *buf, unsigned long len, int height)
+{
+	unsigned long i;
+	
+	for(i = 2; i + 9 <= len; i += 2 + ((buf[i + 2] << 8) | buf[i + 3]))
+	{
+		if(buf[i] != 0xFF) return(-1);
+		if(buf[i + 1] != 0xC0 && buf[i + 1] != 0xC1) continue;
+		
+		buf[i + 5] = height >> 8;
+		buf[i + 6] = height & 0xFF;
+		return(0);
+	}
+	
+	return(-1);
+}
+
+/* Join the slices into one image in buf, replacing it if it's
+ * smaller than size. */
+static int fswc_enc_join(fswc_slices_t *s, int slices, int height,
+                         uint8_t **buf, unsigned long *len,
+                         unsigned long *size)
+{
+	unsigned long *start, total, i;
+	uint8_t *p, *d;
+	int n = 0, k;
+	
+	start = calloc(slices, sizeof(unsigned long));
+	if(!start) return(-1);
+	
+	/* The headers of the first slice are used for the whole image,
+	 * followed by the scan of every slice and a marker after each. */
+	for(total = 0, k = 0; k < slices; k++)
+	{
+		if(fswc_enc_scan(s->buf[k], s->len[k], &start[k]))
+		{
+			free(start);
+			return(-1);
+		}
+		
+		total += s->len[k] - start[k];
+	}
+	
+	total += start[0];
+	
+	if(fswc_enc_height(s->buf[0], start[0], height))
+	{
+		free(start);
+		return(-1);
+	}
+	
+	if(!*buf || *size < total)
+	{
+		free(*buf);
+		*size = 0;
+		
+		if(!(*buf = malloc(total)))
+		{
+			free(start);
+			return(-1);
+		}
+		
+		*size = total;
+	}
+	
+	d = *buf;
+	memcpy(d, s->buf[0], start[0]);
+	d += start[0];
+	
+	for(k = 0; k < slices; k++)
+	{
+		p = s->buf[k];
+		
+		/* Renumber the slice's own restart markers. Any other 0xFF
+		 * in the scan data is followed by a stuffed 0x00. */
+		for(i = start[k]; i < s->len[k] - 2; i++)
+			if(p[i] == 0xFF && (p[i + 1] & 0xF8) == 0xD0)
+				p[++i] = 0xD0 + (n++ & 7);
+		
+		memcpy(d, p + start[k], s->len[k] - 2 - start[k]);
+		d += s->len[k] - 2 - start[k];
+		
+		/* Finish with the EOI from the last slice. */
+		*(d++) = 0xFF;
+		if(k == slices - 1) *(d++) = 0xD9;
+		else *(d++) = 0xD0 + (n++ & 7);
+	}
+	
+	*len = total;
+	free(start);
+	
+	return(0);
+}
+
+static int fswc_encode_sliced(gdImage *im, fswc_jpeg_opts_t *opts,
+                              uint8_t **buf, unsigned long *len,
+                              unsigned long *size)
+{
+	fswc_slices_t s;
+	int subsample = fswc_enc_subsample(opts);
+	int mcu_w = (subsample == ENC_SUBSAMPLE_444 ? 8 : 16);
+	int mcu_h = (subsample == ENC_SUBSAMPLE_420 ? 16 : 8);
+	int mcu_rows = (gdImageSY(im) + mcu_h - 1) / mcu_h;
+	int mcu_cols = (gdImageSX(im) + mcu_w - 1) / mcu_w;
+	int slices, rows, step, k, r = -1;
+	
+	slices = (opts->slices ? opts->slices : pool_threads());
+	
+	/* Slices are a whole number of restart intervals. */
+	step = (opts->restart > 0 ? opts->restart : 1);
+	rows = (mcu_rows + slices - 1) / slices;
+	rows = (rows + step - 1) / step * step;
+	slices = (mcu_rows + rows - 1) / rows;
+	
+	if(opts->optimize || opts->progressive || slices < 2 ||
+	   (opts->restart > 0 ? opts->restart : rows) * mcu_cols > 0xFFFF)
+		return(fswc_enc_rows(buf, len, size, im, 0, gdImageSY(im), opts, 0));
+	
+	*len = 0;
+	
+	memset(&s, 0, sizeof(s));
+	s.im       = im;
+	s.opts     = opts;
+	s.rows     = rows * mcu_h;
+	s.interval = (opts->restart > 0 ? opts->restart : rows) * mcu_cols;
+	s.buf      = calloc(slices, sizeof(uint8_t *));
+	s.len      = calloc(slices, sizeof(unsigned long));
+	
+	if(!s.buf || !s.len)
+	{
+		ERROR("Out of memory.");
+		free(s.buf);
+		free(s.len);
+		return(-1);
+	}
+	
+	DEBUG("Encoding JPEG image in %i slices.", slices);
+	
+	pool_run(slices, fswc_enc_slice, &s);
+	
+	if(!s.error)
+	{
+		r = fswc_enc_join(&s, slices, gdImageSY(im), buf, len, size);
+		if(r) ERROR("Error joining the JPEG slices.");
+	}
+	
+	for(k = 0; k < slices; k++) free(s.buf[k]);
+	free(s.buf);
+	free(s.len);
+	
+	return(r);
+}
+
+int fswc_encode_jpeg_mem(gdImage *im, fswc_jpeg_opts_t *opts,
+                         uint8_t **buf, unsigned long *len,
+                         unsigned long *size)
+{
+	if(opts->slices != 1)
+		return(fswc_encode_sliced(im, opts, buf, len, size));
+	
+	return(fswc_enc_rows(buf, len, size, im, 0, gdImageSY(im), opts, 0));
+}
@@ -0,0 +1,212 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2011 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <gd.h>
+#include "fbpool.h"
+#include "log.h"
+
+static struct {
+	
+	pthread_mutex_t lock;
+	
+	/* Oldest first. */
+	gdImage *image[FBPOOL_IMAGES];
+	int images;
+	
+	void *buffer[FBPOOL_BUFFERS];
+	size_t size[FBPOOL_BUFFERS];
+	int buffers;
+	
+	/* Statistics. */
+	unsigned int created;
+	unsigned int reused;
+	
+} fbpool = { PTHREAD_MUTEX_INITIALIZER };
+
+int fbpool_reserve(int w, int h, int n, size_t size)
+{
+	gdImage *im[FBPOOL_IMAGES];
+	void *buffer;
+	int i;
+	
+	if(n > FBPOOL_IMAGES) n = FBPOOL_IMAGES;
+	
+	/* Take any that are already there, so n new ones aren't made. */
+	for(i = 0; i < n; i++)
+	{
+		im[i] = fbpool_image(w, h);
+		if(!im[i]) break;
+	}
+	
+	n = i;
+	for(i = 0; i < n; i++) fbpool_release(im[i]);
+	
+	if(size)
+	{
+		buffer = fbpool_buffer(size);
+		if(buffer) fbpool_release_buffer(buffer, size);
+	}
+	
+	return(0);
+}
+
+void fbpool_free(void)
+{
+	pthread_mutex_lock(&fbpool.lock);
+	
+	DEBUG("Frame pool: %u images created, %u reused.",
+	      fbpool.created, fbpool.reused);
+	
+	while(fbpool.images) gdImageDestroy(fbpool.image[--fbpool.images]);
+	while(fbpool.buffers) free(fbpool.buffer[--fbpool.buffers]);
+	
+	fbpool.created = 0;
+	fbpool.reused  = 0;
+	
+	pthread_mutex_unlock(&fbpool.lock);
+}
+
+gdImage *fbpool_image(int w, int h)
+{
+	gdImage *im = NULL;
+	int i;
+	
+	pthread_mutex_lock(&fbpool.lock);
+	
+	/* Take the most recently used image of the same size. */
+	for(i = fbpool.images - 1; i >= 0; i--)
+	{
+		if(gdImageSX(fbpool.image[i]) != w ||
+		   gdImageSY(fbpool.image[i]) != h) continue;
+		
+		im = fbpool.image[i];
+		memmove(&fbpool.image[i], &fbpool.image[i + 1],
+		        (--fbpool.images - i) * sizeof(gdImage *));
+		break;
+	}
+	
+	if(im) fbpool.reused++;
+	else fbpool.created++;
+	
+	pthread_mutex_unlock(&fbpool.lock);
+	
+	if(!im) return(gdImageCreateTrueColor(w, h));
+	
+	/* Put back the settings of a new image. */
+	gdImageAlphaBlending(im, 1);
+	gdImageSaveAlpha(im, 0);
+	im->transparent = -1;
+	im->thick = 1;
+	im->cx1 = 0;
+	im->cy1 = 0;
+	im->cx2 = w - 1;
+	im->cy2 = h - 1;
+	
+	return(im);
+}
+
+void fbpool_release(gdImage *im)
+{
+	gdImage *old = NULL;
+	
+	if(!im) return;
+	if(!gdImageTrueColor(im))
+	{
+		gdImageDestroy(im);
+		return;
+	}
+	
+	pthread_mutex_lock(&fbpool.lock);
+	
+	/* Make room by dropping the oldest. */
+	if(fbpool.images == FBPOOL_IMAGES)
+	{
+		old = fbpool.image[0];
+		memmove(&fbpool.image[0], &fbpool.image[1],
+		        --fbpool.images * sizeof(gdImage *));
+	}
+	
+	fbpool.image[fbpool.images++] = im;
+	
+	pthread_mutex_unlock(&fbpool.lock);
+	
+	if(old) gdImageDestroy(old);
+}
+
+void *fbpool_buffer(size_t size)
+{
+	void *buffer = NULL;
+	int i, best = -1;
+	
+	pthread_mutex_lock(&fbpool.lock);
+	
+	/* Take the smallest that is large enough. */
+	for(i = 0; i < fbpool.buffers; i++)
+		if(fbpool.size[i] >= size &&
+		   (best < 0 || fbpool.size[i] < fbpool.size[best])) best = i;
+	
+	if(best >= 0)
+	{
+		buffer = fbpool.buffer[best];
+		fbpool.buffer[best] = fbpool.buffer[--fbpool.buffers];
+		fbpool.size[best]   = fbpool.size[fbpool.buffers];
+	}
+	
+	pthread_mutex_unlock(&fbpool.lock);
+	
+	if(!buffer) buffer = malloc(size);
+	if(!buffer) ERROR("Out of memory.");
+	
+	return(buffer);
+}
+
+void fbpool_release_buffer(void *buffer, size_t size)
+{
+	void *old = NULL;
+	int i, k;
+	
+	if(!buffer) return;
+	
+	pthread_mutex_lock(&fbpool.lock);
+	
+	k = fbpool.buffers;
+	
+	/* Make room by dropping the smallest, unless it's this one. */
+	if(k == FBPOOL_BUFFERS)
+	{
+		for(k = 0, i = 1; i < fbpool.buffers; i++)
+			if(fbpool.size[i] < fbpool.size[k]) k = i;
+		
+		if(fbpool.size[k] < size) old = fbpool.buffer[k];
+		else
+		{
+			old = buffer;
+			k = -1;
+		}
+	}
+	else fbpool.buffers++;
+	
+	if(k >= 0)
+	{
+		fbpool.buffer[k] = buffer;
+		fbpool.size[k]   = size;
+	}
+	
+	pthread_mutex_unlock(&fbpool.lock);
+	
+	free(old);
+}
+
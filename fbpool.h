@@ -0,0 +1,43 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2011 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+#ifndef INC_FBPOOL_H
+#define INC_FBPOOL_H
+
+#include <stddef.h>
+#include <gd.h>
+
+/* Images and buffers released by one shot are kept for the next, so
+ * a running capture doesn't keep allocating and faulting in memory
+ * the size of a frame. Safe to use from any thread. */
+
+/* Number of images and buffers kept. */
+#define FBPOOL_IMAGES  (8)
+#define FBPOOL_BUFFERS (4)
+
+/* Fills the pool at the start of a stream with n images of w x h and
+ * a buffer of size bytes, if size isn't 0. */
+extern int fbpool_reserve(int w, int h, int n, size_t size);
+
+/* Frees everything in the pool. */
+extern void fbpool_free(void);
+
+/* Used in place of gdImageCreateTrueColor() and gdImageDestroy(). The
+ * pixels of a reused image are not cleared. Any image can be
+ * released, those that can't be reused are destroyed. */
+extern gdImage *fbpool_image(int w, int h);
+extern void fbpool_release(gdImage *im);
+
+/* Returns an uncleared buffer of at least size bytes. It's released
+ * with the same size. */
+extern void *fbpool_buffer(size_t size);
+extern void fbpool_release_buffer(void *buffer, size_t size);
+
+#endif
+
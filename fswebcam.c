@@ -20,14 +20,24 @@
 #include <gd.h>
 #include <errno.h>
 #include <signal.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include "fswebcam.h"
 #include "log.h"
 #include "src.h"
 #include "dec.h"
+#include "enc.h"
 #include "effects.h"
 #include "parse.h"
+#include "queue.h"
+#include "pool.h"
+#include "writer.h"
+#include "fbpool.h"
+#include "sched.h"
+#include "overlay.h"
+#include "stats.h"
 
 #define ALIGN_LEFT   (0)
 #define ALIGN_CENTER (1)
@@ -93,6 +103,23 @@ enum fswc_options {
 	OPT_EXEC,
 	OPT_DUMPFRAME,
 	OPT_FPS,
+	OPT_PASSTHROUGH,
+	OPT_NO_PASSTHROUGH,
+	OPT_PIPELINE,
+	OPT_THREADS,
+	OPT_JPEG_FAST_DECODE,
+	OPT_JPEG_SUBSAMPLE,
+	OPT_JPEG_OPTIMIZE,
+	OPT_NO_JPEG_OPTIMIZE,
+	OPT_JPEG_PROGRESSIVE,
+	OPT_NO_JPEG_PROGRESSIVE,
+	OPT_JPEG_DCT,
+	OPT_JPEG_RESTART,
+	OPT_JPEG_SLICES,
+	OPT_WRITE_QUEUE,
+	OPT_WRITE_POLICY,
+	OPT_WRITE_SYNC,
+	OPT_STATS,
 };
 
 typedef struct {
@@ -116,7 +143,7 @@ typedef struct {
 	char    *options;
 } fswebcam_job_t;
 
-typedef struct {
+struct fswebcam_config {
 	
 	/* General options. */
 	unsigned long loop;
@@ -166,6 +193,9 @@ typedef struct {
 	char shadow;
 	/*Interval between taking two image*/
 	int interval;
+	char pipeline;
+	int threads;
+	char jpeg_fast;
 
 	/* Overlay options. */
 	char *underlay;
@@ -176,10 +206,20 @@ typedef struct {
 	char *filename;
 	char format;
 	char compression;
+	char quality_set; /* --jpeg gave a quality */
+	char passthrough;
+	fswc_jpeg_opts_t jpeg;
+	int write_queue;
+	int write_policy;
+	int write_sync;
+	
+	/* Statistics options. */
+	char *stats;
 	
-} fswebcam_config_t;
+};
 
 volatile char received_sigusr1 = 0;
+volatile char received_sigusr2 = 0;
 volatile char received_sighup  = 0;
 volatile char received_sigterm = 0;
 
@@ -190,6 +230,13 @@ void fswc_signal_usr1_handler(int signum)
 	received_sigusr1 = 1;
 }
 
+void fswc_signal_usr2_handler(int signum)
+{
+	/* Catches SIGUSR2 */
+	INFO("Caught signal SIGUSR2.");
+	received_sigusr2 = 1;
+}
+
 void fswc_signal_hup_handler(int signum)
 {
 	/* Catches SIGHUP */
@@ -216,6 +263,7 @@ void fswc_signal_term_handler(int signum)
 int fswc_setup_signals()
 {
 	signal(SIGUSR1, fswc_signal_usr1_handler);
+	signal(SIGUSR2, fswc_signal_usr2_handler);
 	signal(SIGHUP,  fswc_signal_hup_handler);
 	signal(SIGTERM, fswc_signal_term_handler);
 	signal(SIGINT,  fswc_signal_term_handler);
@@ -322,358 +370,1455 @@ void fswc_DrawText(gdImagePtr im, char *font, double size,
 	gdImageStringFT(im, NULL, colour, font, size, 0.0, x, y, text);
 }
 
-int fswc_draw_overlay(fswebcam_config_t *config, char *filename, gdImage *image){
-	FILE *f;
-	gdImage *overlay;
+/* The decoded underlay and overlay images. */
+static overlay_t fswc_underlay;
+static overlay_t fswc_overlay;
+
+/* The banner is drawn in two parts. Everything but the timestamp is
+ * drawn once onto a transparent layer, which is blended onto each
+ * image. The timestamp is put together from glyphs rendered once each
+ * by FreeType. Both are redrawn when the image width or the banner
+ * options change. */
+
+typedef struct {
+	uint8_t *mask; /* Coverage, 0 - 255 */
+	int w, h;
+	int x, y;      /* Top left of the mask from the pen position */
+	int advance;   /* In eighths of a pixel */
+	int right;     /* Right edge of the ink from the pen position */
+	char ready;
+} fswc_glyph_t;
+
+typedef struct {
+	
+	/* The options the banner was drawn for. */
+	char valid;
+	int width;
+	char banner;
+	uint32_t bg_colour;
+	uint32_t bl_colour;
+	uint32_t fg_colour;
+	char *title;
+	char *subtitle;
+	char *info;
+	char *font;
+	int fontsize;
+	char shadow;
+	
+	/* Set if the font can't be used. */
+	char disabled;
+	
+	gdImage *layer;
+	int height;    /* Height of the banner box */
+	int line;      /* Rows of the layer above the box */
+	
+	fswc_glyph_t glyph[128];
+	
+} fswc_banner_t;
+
+static fswc_banner_t fswc_banner;
+
+static int fswc_banner_same_str(char *a, char *b)
+{
+	if(!a || !b) return(a == b);
+	return(!strcmp(a, b));
+}
+
+static int fswc_banner_same(fswebcam_config_t *config, int width)
+{
+	fswc_banner_t *b = &fswc_banner;
+	
+	return(b->valid && b->width == width &&
+	       b->banner    == config->banner &&
+	       b->bg_colour == config->bg_colour &&
+	       b->bl_colour == config->bl_colour &&
+	       b->fg_colour == config->fg_colour &&
+	       b->fontsize  == config->fontsize &&
+	       b->shadow    == config->shadow &&
+	       fswc_banner_same_str(b->title, config->title) &&
+	       fswc_banner_same_str(b->subtitle, config->subtitle) &&
+	       fswc_banner_same_str(b->info, config->info) &&
+	       fswc_banner_same_str(b->font, config->font));
+}
+
+static void fswc_banner_free(void)
+{
+	fswc_banner_t *b = &fswc_banner;
+	int i;
+	
+	if(b->layer) gdImageDestroy(b->layer);
+	for(i = 0; i < 128; i++) free(b->glyph[i].mask);
+	
+	free(b->title);
+	free(b->subtitle);
+	free(b->info);
+	free(b->font);
+	
+	memset(b, 0, sizeof(fswc_banner_t));
+}
+
+static char *fswc_banner_strdup(char *s)
+{
+	return(s ? strdup(s) : NULL);
+}
+
+static void fswc_banner_build(fswebcam_config_t *config, int w)
+{
+	fswc_banner_t *b = &fswc_banner;
+	char *err;
+	int spacing = 4;
+	int y;
+	
+	fswc_banner_free();
+	
+	b->valid     = 1;
+	b->width     = w;
+	b->banner    = config->banner;
+	b->bg_colour = config->bg_colour;
+	b->bl_colour = config->bl_colour;
+	b->fg_colour = config->fg_colour;
+	b->title     = fswc_banner_strdup(config->title);
+	b->subtitle  = fswc_banner_strdup(config->subtitle);
+	b->info      = fswc_banner_strdup(config->info);
+	b->font      = fswc_banner_strdup(config->font);
+	b->fontsize  = config->fontsize;
+	b->shadow    = config->shadow;
+	
+	/* Check if drawing text works */
+	err = gdImageStringFT(NULL, NULL, 0, config->font, config->fontsize, 0.0, 0, 0, "");
+	if(err)
+	{
+		/* Can't load the font - display a warning */
+		WARN("Unable to load font '%s': %s", config->font, err);
+		WARN("Disabling the the banner.");
+		b->disabled = 1;
+		return;
+	}
 	
-	if(!filename) return(-1);
+	/* Calculate the height of the banner. */
+	b->height = config->fontsize + (spacing * 2);
+	
+	if(config->subtitle || config->info)
+		b->height += config->fontsize * 0.8 + spacing;
 	
-	f = fopen(filename, "rb");
-	if(!f)
+	/* The layer covers the box and the line, which is two rows
+	 * below a top banner or above a bottom one. */
+	b->line  = (config->banner == BOTTOM_BANNER ? 2 : 0);
+	b->layer = gdImageCreateTrueColor(w, b->height + 3);
+	if(!b->layer)
 	{
-		ERROR("Unable to open '%s'", filename);
-		ERROR("fopen: %s", strerror(errno));
+		ERROR("Out of memory.");
+		b->disabled = 1;
+		return;
+	}
+	
+	gdImageAlphaBlending(b->layer, 0);
+	gdImageFilledRectangle(b->layer, 0, 0, w, b->height + 3,
+	                       gdTrueColorAlpha(0, 0, 0, gdAlphaTransparent));
+	gdImageAlphaBlending(b->layer, 1);
+	
+	/* Draw the banner line. */
+	if(config->banner == TOP_BANNER)
+		gdImageFilledRectangle(b->layer, 0, b->height + 1,
+		                       w, b->height + 2, config->bl_colour);
+	else gdImageFilledRectangle(b->layer, 0, 0, w, 1, config->bl_colour);
+	
+	/* Draw the background box. */
+	gdImageFilledRectangle(b->layer,
+	   0, b->line,
+	   w, b->line + b->height,
+	   config->bg_colour);
+	
+	y = b->line + spacing + config->fontsize;
+	
+	/* Draw the title. */
+	fswc_DrawText(b->layer, config->font, config->fontsize,
+	              spacing, y, ALIGN_LEFT,
+	              config->fg_colour, config->shadow, config->title);
+	
+	y += spacing + config->fontsize * 0.8;
+	
+	/* Draw the sub-title. */
+	fswc_DrawText(b->layer, config->font, config->fontsize * 0.8,
+	              spacing, y, ALIGN_LEFT,
+	              config->fg_colour, config->shadow, config->subtitle);
+	
+	/* Draw the info text. */
+	fswc_DrawText(b->layer, config->font, config->fontsize * 0.7,
+	              w - spacing, y, ALIGN_RIGHT,
+	              config->fg_colour, config->shadow, config->info);
+}
+
+/* Width of the ink of the text, from the left edge. */
+static int fswc_text_width(char *font, double size, char *text)
+{
+	int brect[8];
+	
+	if(gdImageStringFT(NULL, &brect[0], 0xFFFFFF, font, size, 0.0, 0, 0, text))
+		return(-1);
+	
+	return(brect[2] - brect[0]);
+}
+
+/* Render a glyph white on black, the red channel is its coverage. */
+static int fswc_glyph_render(fswc_glyph_t *g, char *font, double size, char c)
+{
+	char text[11];
+	int brect[8];
+	int w1, w2, x, y;
+	gdImage *im;
+	
+	/* Only a fully drawn glyph has a mask, so a glyph that fails is
+	 * drawn the slow way. */
+	g->ready = 1;
+	free(g->mask);
+	g->mask = NULL;
+	
+	/* The advance is measured across eight copies between two bars,
+	 * as a space has no ink of its own and advances are fractional. */
+	text[0] = '|';
+	memset(&text[1], c, 8);
+	text[9] = '|';
+	text[10] = '\0';
+	w1 = fswc_text_width(font, size, text);
+	text[1] = '|';
+	text[2] = '\0';
+	w2 = fswc_text_width(font, size, text);
+	if(w1 < 0 || w2 < 0) return(-1);
+	
+	g->advance = w1 - w2;
+	
+	text[0] = c;
+	text[1] = '\0';
+	if(gdImageStringFT(NULL, &brect[0], 0xFFFFFF, font, size, 0.0, 0, 0, text))
+		return(-1);
+	
+	g->right = brect[2];
+	g->w = brect[2] - brect[0] + 4;
+	g->h = brect[1] - brect[7] + 4;
+	g->x = brect[0] - 2;
+	g->y = brect[7] - 2;
+	
+	im = gdImageCreateTrueColor(g->w, g->h);
+	g->mask = malloc(g->w * g->h);
+	if(!im || !g->mask)
+	{
+		ERROR("Out of memory.");
+		if(im) gdImageDestroy(im);
+		free(g->mask);
+		g->mask = NULL;
 		return(-1);
 	}
 	
-	overlay = gdImageCreateFromPng(f);
-	fclose(f);
+	gdImageStringFT(im, NULL, 0xFFFFFF, font, size, 0.0, -g->x, -g->y, text);
+	
+	for(y = 0; y < g->h; y++)
+		for(x = 0; x < g->w; x++)
+			g->mask[y * g->w + x] = gdTrueColorGetRed(im->tpixels[y][x]);
+	
+	gdImageDestroy(im);
+	
+	return(0);
+}
+
+/* Blend a glyph onto the image in the colour, as gd would draw it. */
+static void fswc_glyph_draw(gdImage *im, fswc_glyph_t *g, int px, int py,
+                            uint32_t colour)
+{
+	int alpha = gdTrueColorGetAlpha(colour);
+	int x, y, ix, iy;
+	
+	for(y = 0; y < g->h; y++)
+	{
+		uint8_t *m = g->mask + y * g->w;
+		int *row;
+		
+		iy = py + g->y + y;
+		if(iy < 0 || iy >= gdImageSY(im)) continue;
+		
+		row = im->tpixels[iy];
+		
+		for(x = 0; x < g->w; x++)
+		{
+			int a;
+			
+			ix = px + g->x + x;
+			if(!m[x] || ix < 0 || ix >= gdImageSX(im)) continue;
+			
+			a = gdAlphaMax - m[x] * (gdAlphaMax - alpha) / 255;
+			row[ix] = gdAlphaBlend(row[ix], (a << 24) | (colour & 0xFFFFFF));
+		}
+	}
+}
+
+/* Draw the timestamp from cached glyphs, right aligned to x. Returns
+ * -1 if there's a character that isn't cached, so it can be drawn
+ * the slow way. */
+static int fswc_draw_timestamp(fswebcam_config_t *config, gdImage *im,
+                               int x, int y, char *text)
+{
+	fswc_glyph_t *g = fswc_banner.glyph;
+	uint32_t colour = config->fg_colour;
+	double size = config->fontsize * 0.8;
+	unsigned char *c;
+	int w = 0;
 	
-	if(!overlay)
+	for(c = (unsigned char *) text; *c; c++)
 	{
-		ERROR("Unable to read '%s'. Not a PNG image?", filename);
+		if(*c < ' ' || *c > '~') return(-1);
+		if(!g[*c].ready) fswc_glyph_render(&g[*c], config->font, size, *c);
+		if(!g[*c].mask) return(-1);
+		
+		w += (c[1] ? g[*c].advance : g[*c].right * 8);
+	}
+	
+	x = x * 8 - w;
+	
+	/* Correct alpha value for GD, as in fswc_DrawText(). */
+	colour = (((colour & 0xFF000000) / 2) & 0xFF000000) +
+	         (colour & 0xFFFFFF);
+	
+	for(c = (unsigned char *) text; *c; x += g[*c].advance, c++)
+	{
+		int px = (x + 4) >> 3;
+		
+		if(config->shadow)
+			fswc_glyph_draw(im, &g[*c], px + 1, y + 1, colour & 0xFF000000);
+		
+		fswc_glyph_draw(im, &g[*c], px, y, colour);
+	}
+	
+	return(0);
+}
+
+int fswc_draw_banner(fswebcam_config_t *config, gdImage *image)
+{
+	fswc_banner_t *b = &fswc_banner;
+	char timestamp[200];
+	int w, h;
+	int spacing = 4;
+	int top;
+	int x, y;
+	
+	w = gdImageSX(image);
+	h = gdImageSY(image);
+	
+	if(!fswc_banner_same(config, w)) fswc_banner_build(config, w);
+	if(b->disabled) return(-1);
+	
+	/* Blend the layer onto the image. */
+	top = (config->banner == BOTTOM_BANNER ? h - b->height : 0);
+	
+	for(y = 0; y < gdImageSY(b->layer); y++)
+	{
+		int *src = b->layer->tpixels[y];
+		int *dst;
+		
+		if(top - b->line + y < 0 || top - b->line + y >= h) continue;
+		dst = image->tpixels[top - b->line + y];
+		
+		for(x = 0; x < w; x++)
+			if(gdTrueColorGetAlpha(src[x]) != gdAlphaTransparent)
+				dst[x] = gdAlphaBlend(dst[x], src[x]);
+	}
+	
+	/* Create the timestamp text. */
+	fswc_strftime(timestamp, 200, config->timestamp,
+	              config->start, config->gmt);
+	
+	/* Draw the timestamp. */
+	y = top + spacing + config->fontsize;
+	
+	if(fswc_draw_timestamp(config, image, w - spacing, y, timestamp))
+		fswc_DrawText(image, config->font, config->fontsize * 0.8,
+		              w - spacing, y, ALIGN_RIGHT,
+		              config->fg_colour, config->shadow, timestamp);
+	
+	return(0);
+}
+
+gdImage* fswc_gdImageDuplicate(gdImage* src)
+{
+	gdImage *dst;
+	
+	dst = fbpool_image(gdImageSX(src), gdImageSY(src));
+	if(!dst) return(NULL);
+	
+	gdImageCopy(dst, src, 0, 0, 0, 0, gdImageSX(src), gdImageSY(src));
+	
+	return(dst);
+}
+
+int fswc_output_name(fswebcam_config_t *config, char *name,
+                     time_t timestamp, char *filename)
+{
+	if(!name) return(-1);
+	if(!strncmp(name, "-", 2) && config->background)
+	{
+		ERROR("stdout is unavailable in background mode.");
 		return(-1);
 	}
 	
-	gdImageCopy(image, overlay, 0, 0, 0, 0, overlay->sx, overlay->sy);
-	gdImageDestroy(overlay);
+	/* "-" is left as it is and written to stdout. */
+	fswc_strftime(filename, FILENAME_MAX, name,
+	              timestamp, config->gmt);
+	
+	return(0);
+}
+
+int fswc_draw(fswebcam_config_t *config, gdImage *im)
+{
+	int64_t t;
+	
+	/* Load the underlay and overlay again after a SIGHUP. */
+	if(received_sighup)
+	{
+		received_sighup = 0;
+		overlay_reload(&fswc_underlay);
+		overlay_reload(&fswc_overlay);
+	}
+	
+	/* Draw the underlay. */
+	t = stats_clock();
+	if(config->underlay)
+	{
+		overlay_draw(&fswc_underlay, config->underlay, im);
+		t = stats_lap("underlay", t);
+	}
+	
+	/* Draw the banner. */
+	if(config->banner != NO_BANNER)
+	{
+		fswc_draw_banner(config, im);
+		t = stats_lap("banner", t);
+	}
+	
+	/* Draw the overlay. */
+	if(config->overlay)
+	{
+		overlay_draw(&fswc_overlay, config->overlay, im);
+		stats_lap("overlay", t);
+	}
+	
+	return(0);
+}
+
+int fswc_encode(fswebcam_config_t *config, gdImage *im, uint8_t **buf,
+                unsigned long *len, unsigned long *size)
+{
+	fswc_jpeg_opts_t opts;
+	int64_t t;
+	
+	opts = config->jpeg;
+	opts.quality = config->compression;
+	
+	t = stats_clock();
+	if(fswc_encode_jpeg_mem(im, &opts, buf, len, size)) return(-1);
+	stats_lap("encode", t);
+	
+	return(0);
+}
+
+int fswc_write_image(fswebcam_config_t *config, char *name,
+                     time_t timestamp, gdImage *im)
+{
+	char filename[FILENAME_MAX];
+	uint8_t *buf;
+	unsigned long len, size;
+	
+	if(fswc_output_name(config, name, timestamp, filename)) return(-1);
+	
+	/* Compress the image into a buffer the writer has finished with,
+	 * the writer then saves it. */
+	MSG("Writing JPEG image to '%s'.", filename);
+	writer_buffer(&buf, &size);
+	
+	if(fswc_encode(config, im, &buf, &len, &size))
+	{
+		free(buf);
+		return(-1);
+	}
+	
+	return(writer_push(filename, buf, len, size));
+}
+
+int fswc_output_passthrough(fswebcam_config_t *config, char *name, src_t *src)
+{
+	char filename[FILENAME_MAX];
+	uint8_t *img = (uint8_t *) src->img;
+	uint8_t *buf, *i;
+	unsigned long len, size;
+	
+	if(fswc_output_name(config, name, config->start, filename)) return(-1);
+	
+	/* The frame is copied out of the capture buffer for the writer,
+	 * adding the Huffman tables if the camera left them out. */
+	i = jpeg_find_dht(img, src->length);
+	len = src->length + (i ? JPEG_DHT_LENGTH : 0);
+	if(!i) i = img + src->length;
+	else DEBUG("Inserting DHT segment into JPEG frame.");
+	
+	writer_buffer(&buf, &size);
+	
+	if(size < len)
+	{
+		free(buf);
+		
+		size = len;
+		buf = malloc(size);
+		if(!buf)
+		{
+			ERROR("Out of memory.");
+			return(-1);
+		}
+	}
+	
+	memcpy(buf, img, i - img);
+	if(len != src->length)
+	{
+		memcpy(buf + (i - img), jpeg_dht, JPEG_DHT_LENGTH);
+		memcpy(buf + (i - img) + JPEG_DHT_LENGTH, i, src->length - (i - img));
+	}
+	
+	MSG("Writing JPEG frame to '%s'.", filename);
+	
+	return(writer_push(filename, buf, len, size));
+}
+
+int fswc_exec(fswebcam_config_t *config, char *cmd, time_t timestamp)
+{
+	char *cmdline;
+	FILE *p;
+	
+	cmdline = fswc_strduptime(cmd, timestamp, config->gmt);
+	if(!cmdline) return(-1);
+	
+	MSG("Executing '%s'...", cmdline);
+	
+	p = popen(cmdline, "r");
+	free(cmdline);
+	
+	if(p)
+	{
+		while(!feof(p))
+		{
+			char *n;
+			char line[1024];
+			
+			if(!fgets(line, 1024, p)) break;
+			
+			while((n = strchr(line, '\n'))) *n = '\0';
+			MSG("%s", line);
+		}
+		
+		pclose(p);
+	}
+	else
+	{
+		ERROR("popen: %s", strerror(errno));
+		return(-1);
+	}
+	
+	return(0);
+}
+
+char *fswc_image_name(fswebcam_config_t *config, int number, char *name)
+{
+	/* Images are numbered in the --save directory. */
+	snprintf(name, FILENAME_MAX, "%s%d.jpg", config->save, number);
+	
+	return(name);
+}
+
+int fswc_need_original(fswebcam_config_t *config)
+{
+	uint32_t x;
+	
+	/* Only --revert needs a copy of the unprocessed image. */
+	for(x = 0; x < config->jobs; x++)
+		if(config->job[x]->id == OPT_REVERT) return(1);
+	
+	return(0);
+}
+
+char *fswc_effect_name(uint16_t id)
+{
+	switch(id)
+	{
+	case OPT_REVERT:       return("revert");
+	case OPT_FLIP:         return("flip");
+	case OPT_CROP:         return("crop");
+	case OPT_SCALE:        return("scale");
+	case OPT_ROTATE:       return("rotate");
+	case OPT_DEINTERLACE:  return("deinterlace");
+	case OPT_INVERT:       return("invert");
+	case OPT_GREYSCALE:    return("greyscale");
+	case OPT_SWAPCHANNELS: return("swapchannels");
+	}
+	
+	return(NULL);
+}
+
+int fswc_is_effect(uint16_t id)
+{
+	return(fswc_effect_name(id) != NULL);
+}
+
+void fswc_decode_hint(fswebcam_config_t *config, fswc_hint_t *hint)
+{
+	uint32_t x;
+	
+	memset(hint, 0, sizeof(fswc_hint_t));
+	hint->fast = config->jpeg_fast;
+	
+	if(fswc_need_original(config)) return;
+	
+	/* If the first effect scales the image, the decoder only needs
+	 * to produce an image at least that size. If it crops the image,
+	 * the decoder only needs to convert that area. */
+	for(x = 0; x < config->jobs; x++)
+	{
+		char *options = config->job[x]->options;
+		long w, h;
+		
+		if(!fswc_is_effect(config->job[x]->id)) continue;
+		
+		if(config->job[x]->id == OPT_CROP) hint->crop = options;
+		if(config->job[x]->id != OPT_SCALE) return;
+		
+		w = argtol(options, "x ", 0, 0, 10);
+		h = argtol(options, "x ", 1, 0, 10);
+		
+		if(w > 0 && h > 0)
+		{
+			hint->width  = w;
+			hint->height = h;
+		}
+		
+		return;
+	}
+}
+
+int fswc_process(fswebcam_config_t *config, gdImage **image, gdImage *original,
+                 fswc_hint_t *hint)
+{
+	uint32_t x;
+	
+	/* Run the effects in the jobs list over the image. */
+	for(x = 0; x < config->jobs; x++)
+	{
+		uint16_t id   = config->job[x]->id;
+		char *options = config->job[x]->options;
+		int64_t t = stats_clock();
+		
+		switch(id)
+		{
+		case OPT_REVERT:
+			fbpool_release(*image);
+			*image = fswc_gdImageDuplicate(original);
+			if(!*image)
+			{
+				ERROR("Out of memory.");
+				return(-1);
+			}
+			break;
+		case OPT_FLIP:
+			*image = fx_flip(*image, options);
+			break;
+		case OPT_CROP:
+			/* Skip the crop if the decoder has already done it. */
+			if(hint && hint->cropped && hint->crop == options)
+			{
+				hint->cropped = 0;
+				break;
+			}
+			*image = fx_crop(*image, options);
+			break;
+		case OPT_SCALE:
+			*image = fx_scale(*image, options);
+			break;
+		case OPT_ROTATE:
+			*image = fx_rotate(*image, options);
+			break;
+		case OPT_DEINTERLACE:
+			*image = fx_deinterlace(*image, options);
+			break;
+		case OPT_INVERT:
+			*image = fx_invert(*image, options);
+			break;
+		case OPT_GREYSCALE:
+			*image = fx_greyscale(*image, options);
+			break;
+		case OPT_SWAPCHANNELS:
+			*image = fx_swapchannels(*image, options);
+			break;
+		}
+		
+		if(fswc_is_effect(id)) stats_lap(fswc_effect_name(id), t);
+	}
+	
+	return(0);
+}
+
+int fswc_exec_jobs(fswebcam_config_t *config, time_t timestamp)
+{
+	uint32_t x;
+	char flushed = 0;
+	
+	for(x = 0; x < config->jobs; x++)
+		if(config->job[x]->id == OPT_EXEC)
+		{
+			/* The command may use the saved image. */
+			if(!flushed) writer_flush();
+			flushed = 1;
+			
+			fswc_exec(config, config->job[x]->options, timestamp);
+		}
+	
+	return(0);
+}
+
+int fswc_can_passthrough(fswebcam_config_t *config, src_t *src)
+{
+	fswc_jpeg_opts_t jpeg;
+	uint32_t x;
+	
+	if(!config->passthrough) return(0);
+	
+	/* Only a single, unmodified JPEG frame can be written as it is. */
+	if(src->palette != SRC_PAL_JPEG &&
+	   src->palette != SRC_PAL_MJPEG) return(0);
+	if(config->format != FORMAT_JPEG) return(0);
+	if(config->quality_set) return(0);
+	if(config->frames != 1) return(0);
+	if(config->banner != NO_BANNER) return(0);
+	if(config->underlay || config->overlay) return(0);
+	
+	/* Any encoder option means the image has to be re-encoded. */
+	fswc_jpeg_defaults(&jpeg);
+	if(memcmp(&jpeg, &config->jpeg, sizeof(jpeg))) return(0);
+	
+	for(x = 0; x < config->jobs; x++)
+		if(fswc_is_effect(config->job[x]->id)) return(0);
+	
+	return(1);
+}
+
+/* Number of failed grabs in a row before the device is reopened. */
+#define MAX_GRAB_ERRORS (3)
+
+typedef struct {
+	
+	/* The capture source, kept open between shots. */
+	src_t src;
+	char open;
+	
+	/* The format requested when the stream was negotiated. */
+	char *device;
+	int palette;
+	unsigned int width;
+	unsigned int height;
+	unsigned int fps;
+	
+	/* Number of failed grabs in a row. */
+	unsigned int errors;
+	
+} fswc_session_t;
+
+int fswc_session_open(fswebcam_config_t *config, fswc_session_t *session)
+{
+	src_t *src = &session->src;
+	
+	/* Set source options... */
+	memset(src, 0, sizeof(src_t));
+	src->input      = config->input;
+	src->tuner      = config->tuner;
+	src->frequency  = config->frequency;
+	src->delay      = config->delay;
+	src->timeout    = 15; /* seconds */
+	src->use_read   = config->use_read;
+	src->list       = config->list;
+	src->palette    = config->palette;
+	src->width      = config->width;
+	src->height     = config->height;
+	src->fps        = config->fps;
+	src->option     = config->option;
+	
+	HEAD("--- Opening %s...", config->device);
+	
+	if(src_open(src, config->device) == -1) return(-1);
+	
+	/* Remember what was asked for. The source may have adjusted the
+	 * width and height, the negotiated values are kept in src. */
+	session->device  = config->device;
+	session->palette = config->palette;
+	session->width   = config->width;
+	session->height  = config->height;
+	session->fps     = config->fps;
+	session->errors  = 0;
+	session->open    = 1;
+	
+	/* Have the image for the first shot ready, and the copy of the
+	 * original if one is kept. Stacked frames also need the average
+	 * bitmap. Passthrough frames don't need any. */
+	if(!fswc_can_passthrough(config, src))
+		fbpool_reserve(src->width, src->height,
+		               1 + fswc_need_original(config),
+		               config->frames > 1 ? (size_t) src->width *
+		               src->height * 3 * sizeof(avgbmp_t) : 0);
+	
+	return(0);
+}
+
+int fswc_session_close(fswc_session_t *session)
+{
+	if(!session->open) return(0);
+	
+	/* We are now finished with the capture card. */
+	src_close(&session->src);
+	session->open = 0;
+	
+	return(0);
+}
+
+int fswc_session_changed(fswebcam_config_t *config, fswc_session_t *session)
+{
+	/* Only a change of device or format requires renegotiation. */
+	if(session->device  != config->device)  return(1);
+	if(session->palette != config->palette) return(1);
+	if(session->width   != config->width)   return(1);
+	if(session->height  != config->height)  return(1);
+	if(session->fps     != config->fps)     return(1);
+	
+	return(0);
+}
+
+int fswc_session_grab(fswebcam_config_t *config, fswc_session_t *session)
+{
+	int64_t t;
+	
+	if(session->open && fswc_session_changed(config, session))
+	{
+		MSG("Capture format has changed. Reopening the device.");
+		fswc_session_close(session);
+	}
+	
+	if(!session->open && fswc_session_open(config, session)) return(-1);
+	
+	/* Mostly the wait for the device to fill a buffer. */
+	t = stats_clock();
+	if(src_grab(&session->src) != -1)
+	{
+		stats_lap("capture", t);
+		session->errors = 0;
+		return(0);
+	}
+	
+	/* A single failed grab (timeout, DQBUF error) is usually
+	 * recoverable by re-queueing the buffers. Only tear the
+	 * device down if that keeps failing. */
+	if(++session->errors < MAX_GRAB_ERRORS &&
+	   !src_reset(&session->src))
+	{
+		WARN("Capture failed. Restarting the stream.");
+		
+		if(src_grab(&session->src) != -1)
+		{
+			session->errors = 0;
+			return(0);
+		}
+	}
+	
+	if(session->errors >= MAX_GRAB_ERRORS)
+	{
+		ERROR("Capture failed %i times. Reopening the device.",
+		      session->errors);
+		fswc_session_close(session);
+	}
+	
+	return(-1);
+}
+
+gdImage *fswc_stack(fswebcam_config_t *config, fswc_session_t *session,
+                    fswc_hint_t *hint)
+{
+	src_t *src = &session->src;
+	uint32_t width = src->width, height = src->height;
+	uint32_t x, y, frames = 0;
+	size_t size = (size_t) width * height * 3 * sizeof(avgbmp_t);
+	avgbmp_t *abitmap, *pbitmap;
+	gdImage *image;
+	int64_t t;
+	
+	/* The average bitmap buffer is kept between shots. */
+	abitmap = fbpool_buffer(size);
+	if(!abitmap) return(NULL);
+	
+	memset(abitmap, 0, size);
+	
+	/* Add the frame already captured, then grab the rest. */
+	while(1)
+	{
+		t = stats_clock();
+		
+		if(!fswc_add_image(src, abitmap, hint)) frames++;
+		stats_lap("accumulate", t);
+		
+		if(frames >= config->frames || received_sigterm) break;
+		
+		if(fswc_session_grab(config, session) == -1) break;
+		
+		/* Stop early if the capture format changes. */
+		if(src->width != width || src->height != height) break;
+	}
+	
+	if(!frames)
+	{
+		ERROR("No frames captured.");
+		fbpool_release_buffer(abitmap, size);
+		return(NULL);
+	}
+	
+	if(frames < config->frames)
+		WARN("Only %u of %u frames were captured.", frames,
+		     config->frames);
+	
+	/* Copy the average bitmap image to a gdImage. */
+	t = stats_clock();
+	image = fbpool_image(width, height);
+	if(!image)
+	{
+		ERROR("Out of memory.");
+		fbpool_release_buffer(abitmap, size);
+		return(NULL);
+	}
+	
+	pbitmap = abitmap;
+	for(y = 0; y < height; y++)
+	{
+		int *row = image->tpixels[y];
+		
+		for(x = 0; x < width; x++)
+		{
+			int colour;
+			
+			colour  = (*(pbitmap++) / frames) << 16;
+			colour += (*(pbitmap++) / frames) << 8;
+			colour += (*(pbitmap++) / frames);
+			
+			row[x] = colour;
+		}
+	}
+	
+	stats_lap("convert", t);
+	fbpool_release_buffer(abitmap, size);
+	
+	return(image);
+}
+
+/* Decodes the frame just grabbed, runs the jobs list over it and
+ * draws the banner. *image is left NULL if the frame couldn't be
+ * decoded. Returns -1 on an error that should end the capture. */
+int fswc_render(fswebcam_config_t *config, fswc_session_t *session,
+                gdImage **image)
+{
+	gdImage *original;
+	fswc_hint_t hint;
+	int64_t t;
+	
+	/* A single frame is decoded straight into the image, the
+	 * average bitmap is only needed when stacking frames. */
+	fswc_decode_hint(config, &hint);
+	
+	if(config->frames > 1) *image = fswc_stack(config, session, &hint);
+	else
+	{
+		t = stats_clock();
+		*image = fswc_decode_image(&session->src, &hint);
+		stats_lap("decode", t);
+	}
+	
+	if(!*image)
+	{
+		WARN("Unable to decode the frame.");
+		return(0);
+	}
+	
+	/* Keep a copy of the original image if it's needed. */
+	original = NULL;
+	if(fswc_need_original(config))
+	{
+		original = fswc_gdImageDuplicate(*image);
+		if(!original)
+		{
+			ERROR("Out of memory.");
+			fbpool_release(*image);
+			*image = NULL;
+			return(-1);
+		}
+	}
+	
+	/* Run through the jobs list. */
+	if(fswc_process(config, image, original, &hint))
+	{
+		if(original) fbpool_release(original);
+		*image = NULL;
+		return(-1);
+	}
+	
+	if(original) fbpool_release(original);
+	
+	fswc_draw(config, *image);
+	
+	return(0);
+}
+
+/* Report the stage timings if SIGUSR2 has been caught. */
+void fswc_check_stats(fswebcam_config_t *config)
+{
+	if(!received_sigusr2) return;
+	
+	received_sigusr2 = 0;
+	stats_report(config->stats);
+}
+
+int fswc_grab(fswebcam_config_t *config)
+{
+	int countImages=0;
+	char dumped = 0;
+	fswc_session_t session;
+	sched_t sched;
+	
+	memset(&session, 0, sizeof(session));
+	
+	/* Open the device once, the stream is kept running between shots. */
+	if(fswc_session_open(config, &session)) return(-1);
+	
+	sched_init(&sched, config->interval, config->loop, config->offset);
+	
+	while(!received_sigterm)
+	{
+		gdImage *image;
+		src_t *src;
+		char imgName[FILENAME_MAX];
+		int64_t shot;
+		
+		fswc_check_stats(config);
+		
+		/* Wait for the next shot. SIGUSR1 takes one straight away. */
+		while(sched_wait(&sched) && !received_sigterm && !received_sigusr1)
+			fswc_check_stats(config);
+		if(received_sigterm) break;
+		
+		received_sigusr1 = 0;
+		sched_next(&sched);
+		shot = stats_clock();
+		
+		/* Record the start time. */
+		config->start = time(NULL);
+		
+		HEAD("--- Capturing frame...");
+		
+		if(fswc_session_grab(config, &session) == -1)
+		{
+			/* Give up if the device could not be reopened. */
+			if(!session.open && fswc_session_open(config, &session))
+				return(-1);
+			
+			continue;
+		}
+		
+		src = &session.src;
+		
+		DEBUG("Frame %u: %u bytes, captured at %li.%06li.", src->sequence,
+		      src->length, (long) src->timestamp.tv_sec,
+		      (long) src->timestamp.tv_usec);
+		
+		if(!dumped && config->dumpframe)
+		{
+			/* Dump the raw data from the first frame to file. */
+			FILE *f;
+			
+			MSG("Dumping raw frame to '%s'...", config->dumpframe);
+			
+			f = fopen(config->dumpframe, "wb");
+			if(!f) ERROR("fopen: %s", strerror(errno));
+			else
+			{
+				fwrite(src->img, 1, src->length, f);
+				fclose(f);
+			}
+			
+			dumped = 1;
+		}
+		
+		/* Nothing to draw? Save the camera's own JPEG. */
+		if(fswc_can_passthrough(config, src))
+		{
+			fswc_image_name(config, ++countImages, imgName);
+			fswc_output_passthrough(config, imgName, src);
+			stats_lap("shot", shot);
+			fswc_exec_jobs(config, config->start);
+			continue;
+		}
+		
+		HEAD("--- Processing captured image...");
+		
+		if(fswc_render(config, &session, &image))
+		{
+			fswc_session_close(&session);
+			return(-1);
+		}
+		
+		if(!image) continue;
+		
+		/* Only frames that decoded take a number. */
+		fswc_image_name(config, ++countImages, imgName);
+		
+		/* The image is ours, save it. */
+		fswc_write_image(config, imgName, config->start, image);
+		stats_lap("shot", shot);
+		fswc_exec_jobs(config, config->start);
+		fbpool_release(image);
+	}
+	
+	sched_report(&sched);
+	fswc_session_close(&session);
 	
 	return(0);
 }
 
-int fswc_draw_banner(fswebcam_config_t *config, gdImage *image)
+/* Used by fswebcam-bench. Takes the given number of shots as fast as
+ * the source allows, through the same decode, effects, banner and
+ * encode steps as fswc_grab(), but nothing is saved. A source that
+ * runs out of frames is reopened from the start. Returns the number
+ * of shots taken. */
+int fswc_bench_shots(fswebcam_config_t *config, int shots)
 {
-	char timestamp[200];
-	int w, h;
-	int height;
-	int spacing;
-	int top;
-	int y;
-	
-	w = gdImageSX(image);
-	h = gdImageSY(image);
+	fswc_session_t session;
+	uint8_t *buf = NULL;
+	unsigned long len, size = 0;
+	int taken = 0, failed = 0;
 	
-	/* Create the timestamp text. */
-	fswc_strftime(timestamp, 200, config->timestamp,
-	              config->start, config->gmt);
-	
-	/* Calculate the position and height of the banner. */
-	spacing = 4;
-	height = config->fontsize + (spacing * 2);
+	memset(&session, 0, sizeof(session));
 	
-	if(config->subtitle || config->info)
-		height += config->fontsize * 0.8 + spacing;
-	
-	top = 0;
-	if(config->banner == BOTTOM_BANNER) top = h - height;
+	if(fswc_session_open(config, &session)) return(-1);
 	
-	/* Draw the banner line. */
-	if(config->banner == TOP_BANNER)
+	while(taken < shots && failed < MAX_GRAB_ERRORS)
 	{
-		gdImageFilledRectangle(image,
-		                       0, height + 1,
-		                       w, height + 2,
-		                       config->bl_colour);
-	}
-	else
-	{
-		gdImageFilledRectangle(image,
-		                       0, top - 2,
-		                       w, top - 1,
-		                       config->bl_colour);
+		gdImage *image;
+		int64_t shot = stats_clock();
+		
+		config->start = time(NULL);
+		
+		if(fswc_session_grab(config, &session) == -1)
+		{
+			/* Replay the dump again. */
+			failed++;
+			fswc_session_close(&session);
+			continue;
+		}
+		
+		failed = 0;
+		
+		if(fswc_render(config, &session, &image)) break;
+		if(!image) continue;
+		
+		fswc_encode(config, image, &buf, &len, &size);
+		fbpool_release(image);
+		
+		stats_lap("shot", shot);
+		taken++;
 	}
 	
-	/* Draw the background box. */
-	gdImageFilledRectangle(image,
-	   0, top,
-	   w, top + height,
-	   config->bg_colour);
-	
-	y = top + spacing + config->fontsize;
-	
-	/* Draw the title. */
-	fswc_DrawText(image, config->font, config->fontsize,
-	              spacing, y, ALIGN_LEFT,
-	              config->fg_colour, config->shadow, config->title);
-	
-	/* Draw the timestamp. */
-	fswc_DrawText(image, config->font, config->fontsize * 0.8,
-	              w - spacing, y, ALIGN_RIGHT,
-	              config->fg_colour, config->shadow, timestamp);
-	
-	y += spacing + config->fontsize * 0.8;
+	free(buf);
+	fswc_session_close(&session);
 	
-	/* Draw the sub-title. */
-	fswc_DrawText(image, config->font, config->fontsize * 0.8,
-	              spacing, y, ALIGN_LEFT,
-	              config->fg_colour, config->shadow, config->subtitle);
-	
-	/* Draw the info text. */
-	fswc_DrawText(image, config->font, config->fontsize * 0.7,
-	              w - spacing, y, ALIGN_RIGHT,
-	              config->fg_colour, config->shadow, config->info);
-	return(0);
+	return(taken);
 }
 
-gdImage* fswc_gdImageDuplicate(gdImage* src)
-{
-	gdImage *dst;
+/* Number of captured frames that can wait for processing, and
+ * finished images that can wait for the encoder. */
+#define PIPELINE_FRAMES (4)
+#define PIPELINE_IMAGES (2)
+
+typedef struct {
 	
-	dst = gdImageCreateTrueColor(gdImageSX(src), gdImageSY(src));
-	if(!dst) return(NULL);
+	/* A copy of the captured frame. */
+	void *img;
+	uint32_t size;
+	uint32_t length;
 	
-	gdImageCopy(dst, src, 0, 0, 0, 0, gdImageSX(src), gdImageSY(src));
+	int palette;
+	uint32_t width;
+	uint32_t height;
+	uint32_t sequence;
 	
-	return(dst);
-}
+	time_t start;
+	int64_t captured; /* stats_clock() */
+	int number;
+	
+} fswc_frame_t;
 
-int fswc_output(fswebcam_config_t *config, char *name, gdImage *image)
-{
-	char filename[FILENAME_MAX];
-	gdImage *im;
-	FILE *f;
+typedef struct {
+	gdImage *image;
+	time_t start;
+	int64_t captured;
+	char name[FILENAME_MAX];
+} fswc_image_t;
+
+typedef struct {
 	
-	if(!name) return(-1);
-	if(!strncmp(name, "-", 2) && config->background)
-	{
-		ERROR("stdout is unavailable in background mode.");
-		return(-1);
-	}
+	fswebcam_config_t *config;
 	
-	fswc_strftime(filename, FILENAME_MAX, name,
-	              config->start, config->gmt);
+	/* Capture -> process: full frames. Process -> capture: empty
+	 * frames. When no empty frame is free the capture thread drops
+	 * the new frame instead of stalling the device queue. */
+	queue_t frames;
+	queue_t empty;
 	
-	/* Create a temporary image buffer. */
-	im = fswc_gdImageDuplicate(image);
-	if(!im)
-	{
-		ERROR("Out of memory.");
-		return(-1);
-	}
+	/* Process -> encode. Blocks when the encoder falls behind, which
+	 * in turn makes the capture thread drop frames. */
+	queue_t images;
 	
-	/* Draw the underlay. */
-	fswc_draw_overlay(config, config->underlay, im);
+	fswc_frame_t frame[PIPELINE_FRAMES];
 	
-	/* Draw the banner. */
-	if(config->banner != NO_BANNER)
+} fswc_pipeline_t;
+
+void *fswc_pipeline_process(void *arg)
+{
+	fswc_pipeline_t *p = (fswc_pipeline_t *) arg;
+	fswebcam_config_t *config = p->config;
+	fswc_frame_t *frame;
+	
+	while((frame = queue_pop(&p->frames, 1)))
 	{
-		char *err;
+		gdImage *image, *original;
+		fswc_hint_t hint;
+		fswc_image_t *out;
+		src_t src;
+		int64_t t;
+		
+		/* The decoders only need the frame and its format. */
+		memset(&src, 0, sizeof(src));
+		src.img      = frame->img;
+		src.length   = frame->length;
+		src.palette  = frame->palette;
+		src.width    = frame->width;
+		src.height   = frame->height;
+		src.sequence = frame->sequence;
+		
+		/* The banner and filename use the capture time. */
+		config->start = frame->start;
+		
+		out = malloc(sizeof(fswc_image_t));
+		if(!out)
+		{
+			ERROR("Out of memory.");
+			queue_push(&p->empty, frame);
+			continue;
+		}
+		
+		out->start = frame->start;
+		out->captured = frame->captured;
+		fswc_image_name(config, frame->number, out->name);
+		
+		if(fswc_can_passthrough(config, &src))
+		{
+			fswc_output_passthrough(config, out->name, &src);
+			stats_lap("shot", out->captured);
+			fswc_exec_jobs(config, out->start);
+			queue_push(&p->empty, frame);
+			free(out);
+			continue;
+		}
 		
-		/* Check if drawing text works */
-		err = gdImageStringFT(NULL, NULL, 0, config->font, config->fontsize, 0.0, 0, 0, "");
+		fswc_decode_hint(config, &hint);
+		t = stats_clock();
+		image = fswc_decode_image(&src, &hint);
+		stats_lap("decode", t);
 		
-		if(!err) fswc_draw_banner(config, im);
-		else
+		/* The frame is no longer needed, hand it back. */
+		queue_push(&p->empty, frame);
+		
+		if(!image)
+		{
+			WARN("Unable to decode frame %u.", src.sequence);
+			free(out);
+			continue;
+		}
+		
+		original = NULL;
+		if(fswc_need_original(config))
+		{
+			original = fswc_gdImageDuplicate(image);
+			if(!original)
+			{
+				ERROR("Out of memory.");
+				fbpool_release(image);
+				free(out);
+				continue;
+			}
+		}
+		
+		fswc_process(config, &image, original, &hint);
+		if(original) fbpool_release(original);
+		
+		if(!image)
 		{
-			/* Can't load the font - display a warning */
-			WARN("Unable to load font '%s': %s", config->font, err);
-			WARN("Disabling the the banner.");
+			free(out);
+			continue;
 		}
+		
+		fswc_draw(config, image);
+		
+		out->image = image;
+		queue_push(&p->images, out);
 	}
 	
-	/* Draw the overlay. */
-	fswc_draw_overlay(config, config->overlay, im);
+	/* No more frames, let the encoder finish. */
+	queue_close(&p->images);
 	
-	/* Write to a file if a filename was given, otherwise stdout. */
-	if(strncmp(name, "-", 2)) f = fopen(filename, "wb");
-	else f = stdout;
+	return(NULL);
+}
+
+void *fswc_pipeline_encode(void *arg)
+{
+	fswc_pipeline_t *p = (fswc_pipeline_t *) arg;
+	fswc_image_t *out;
 	
-	if(!f)
+	while((out = queue_pop(&p->images, 1)))
 	{
-		ERROR("Error opening file for output: %s", filename);
-		ERROR("fopen: %s", strerror(errno));
-		gdImageDestroy(im);
-		return(-1);
+		fswc_write_image(p->config, out->name, out->start, out->image);
+		stats_lap("shot", out->captured);
+		fswc_exec_jobs(p->config, out->start);
+		
+		fbpool_release(out->image);
+		free(out);
 	}
 	
-	/* Write the compressed image. */
-	MSG("Writing JPEG image to '%s'.", filename);
-	gdImageJpeg(im, f, config->compression);
-	//break;
-
-	if(f != stdout) fclose(f);
-	
-	gdImageDestroy(im);
-	
-	return(0);
+	return(NULL);
 }
 
-int fswc_exec(fswebcam_config_t *config, char *cmd)
+int fswc_pipeline(fswebcam_config_t *config)
 {
-	char *cmdline;
-	FILE *p;
+	fswc_pipeline_t p;
+	fswc_session_t session;
+	pthread_t process, encode;
+	sched_t sched;
+	int countImages = 0;
+	uint32_t dropped = 0;
+	int i;
 	
-	cmdline = fswc_strduptime(cmd, config->start, config->gmt);
-	if(!cmdline) return(-1);
+	memset(&p, 0, sizeof(p));
+	memset(&session, 0, sizeof(session));
+	p.config = config;
 	
-	MSG("Executing '%s'...", cmdline);
+	if(config->frames > 1)
+		WARN("--frames is ignored in pipeline mode.");
 	
-	p = popen(cmdline, "r");
-	free(cmdline);
+	if(fswc_session_open(config, &session)) return(-1);
 	
-	if(p)
+	if(queue_init(&p.frames, PIPELINE_FRAMES, QUEUE_DROP) ||
+	   queue_init(&p.empty,  PIPELINE_FRAMES, QUEUE_DROP) ||
+	   queue_init(&p.images, PIPELINE_IMAGES, QUEUE_BLOCK))
 	{
-		while(!feof(p))
+		fswc_session_close(&session);
+		return(-1);
+	}
+	
+	for(i = 0; i < PIPELINE_FRAMES; i++) queue_push(&p.empty, &p.frame[i]);
+	
+	if(pthread_create(&process, NULL, fswc_pipeline_process, &p) ||
+	   pthread_create(&encode, NULL, fswc_pipeline_encode, &p))
+	{
+		ERROR("Unable to start the pipeline threads.");
+		exit(-1);
+	}
+	
+	HEAD("--- Capturing frames...");
+	
+	sched_init(&sched, config->interval, config->loop, config->offset);
+	
+	/* This thread only captures, everything else is done by the
+	 * process and encode threads. */
+	while(!received_sigterm)
+	{
+		fswc_frame_t *frame;
+		src_t *src = &session.src;
+		
+		fswc_check_stats(config);
+		
+		if(fswc_session_grab(config, &session) == -1)
 		{
-			char *n;
-			char line[1024];
+			/* Give up if the device could not be reopened. */
+			if(!session.open && fswc_session_open(config, &session))
+				break;
 			
-			if(!fgets(line, 1024, p)) break;
+			continue;
+		}
+		
+		/* With --interval or --loop only the first frame after each
+		 * deadline is kept. The rest are still dequeued to keep the
+		 * stream running. SIGUSR1 keeps the next frame. */
+		if(!sched_due(&sched) && !received_sigusr1) continue;
+		
+		frame = queue_pop(&p.empty, 0);
+		if(!frame)
+		{
+			DEBUG("Processing is behind. Dropping frame %u.",
+			      src->sequence);
+			dropped++;
+			continue;
+		}
+		
+		if(frame->size < src->length)
+		{
+			void *n = realloc(frame->img, src->length);
 			
-			while((n = strchr(line, '\n'))) *n = '\0';
-			MSG("%s", line);
+			if(!n)
+			{
+				/* Only the process thread pushes to the empty
+				 * queue. The frame is freed with the rest below. */
+				ERROR("Out of memory.");
+				break;
+			}
+			
+			frame->img  = n;
+			frame->size = src->length;
 		}
 		
-		pclose(p);
-	}
-	else
-	{
-		ERROR("popen: %s", strerror(errno));
-		return(-1);
+		memcpy(frame->img, src->img, src->length);
+		frame->length   = src->length;
+		frame->palette  = src->palette;
+		frame->width    = src->width;
+		frame->height   = src->height;
+		frame->sequence = src->sequence;
+		frame->start    = time(NULL);
+		frame->captured = stats_clock();
+		frame->number   = ++countImages;
+		
+		queue_push(&p.frames, frame);
+		
+		received_sigusr1 = 0;
+		sched_next(&sched);
 	}
 	
-	return(0);
-}
-
-int fswc_grab(fswebcam_config_t *config)
-{
-	int countImages=0;
-	while(1){
-			char* deviceName="/dev/video0";//strdup("/dev/video0")
-			uint32_t frame;
-			uint32_t x, y;
-			avgbmp_t *abitmap, *pbitmap;
-			gdImage *image, *original;
-			uint8_t modified;
-			src_t src;
-
-			/* Set source options... */
-			memset(&src, 0, sizeof(src));
-			src.input      = config->input;
-			src.tuner      = config->tuner;
-			src.frequency  = config->frequency;
-			src.delay      = config->delay;
-			src.timeout    = 15; /* seconds */
-			src.use_read   = config->use_read;
-			src.list       = config->list;
-			src.palette    = config->palette;
-			src.width      = config->width;
-			src.height     = config->height;
-			src.fps        = config->fps;
-			src.option     = config->option;
-
-			HEAD("--- Opening %s...%s", deviceName, config->device);
-			printf("--- Opening %s...%s", deviceName, config->device);
-			if(src_open(&src, deviceName) == -1) return(-1);
-			//if(src_open(&src, config->device) == -1) return(-1);
-			/* The source may have adjusted the width and height we passed
-			 * to it. Update the main config to match. */
-
-			//
-			char countImageStr[20];
-			while(1){
-				countImages++;
-				/* Record the start time. */
-				config->start = time(NULL);
-				/* Allocate memory for the average bitmap buffer. */
-				/* Allocate memory for the average bitmap buffer. */
-				abitmap = calloc(config->width * config->height * 3, sizeof(avgbmp_t));
-				if(!abitmap)
-				{
-					ERROR("Out of memory.");
-					return(-1);
-				}
-
-				HEAD("--- Capturing frame...");
-
-				//if required timeout , break
-				if(src_grab(&src) != -1) {
-					/* Add frame to the average bitmap. */
-					fswc_add_image_jpeg(&src, abitmap);
-				}else{
-					break;
-				}
-
-				HEAD("--- Processing captured image...");
-
-				/* Copy the average bitmap image to a gdImage. */
-				original = gdImageCreateTrueColor(config->width, config->height);
-				printf("height is %d, width is %d------\n", config->height, config->width);
-				if(!original)
-				{
-					ERROR("Out of memory.");
-					free(abitmap);
-					return(-1);
-				}
-
-				pbitmap = abitmap;
-				for(y = 0; y < config->height; y++)
-					for(x = 0; x <  config->width; x++)
-					{
-						int px = x;
-						int py = y;
-						int colour;
-
-						colour  = (*(pbitmap++) / config->frames) << 16;
-						colour += (*(pbitmap++) / config->frames) << 8;
-						colour += (*(pbitmap++) / config->frames);
-
-						gdImageSetPixel(original, px, py, colour);
-					}
-
-				free(abitmap);
-
-				/* Make a copy of the original image. */
-				image = fswc_gdImageDuplicate(original);
-				if(!image)
-				{
-					ERROR("Out of memory.");
-					gdImageDestroy(image);
-					return(-1);
-				}
-
-				/* Run through the jobs list. */
-
-
-				snprintf(countImageStr, 20, "%d", countImages);
-				printf("countImageStr = %s\n", countImageStr);
-				//Generate the imgName
-				char imgName[50];
-				char imgScaleName[50];
-				bzero(imgName, 50);
-				bzero(imgScaleName, 50);
-				strcat(imgName, config->save);
-				//strcat(imgName, "img");
-				strcat(imgName, countImageStr);
-				strcat(imgName, ".jpg");
-				strcat(imgScaleName, "scaleImg");
-				strcat(imgScaleName, countImageStr);
-				strcat(imgScaleName, ".jpg");
-				//rotate the image
-				//image = fx_rotate(image, "180");
-				usleep(config->interval);
-				//save file, and scale
-				fswc_output(config, imgName, image);
-				//image = fx_scale(image, "256x192");
-				//fswc_output(config, imgScaleName, image);
-				gdImageDestroy(image);
-				gdImageDestroy(original);
-
-			}
-
-			/* We are now finished with the capture card. */
-			src_close(&src);
-	}
+	/* Drain the pipeline. */
+	queue_close(&p.frames);
+	pthread_join(process, NULL);
+	pthread_join(encode, NULL);
+	
+	fswc_session_close(&session);
+	
+	MSG("Pipeline: %i frames kept, %u dropped.", countImages, dropped);
+	sched_report(&sched);
+	
+	for(i = 0; i < PIPELINE_FRAMES; i++) free(p.frame[i].img);
+	queue_free(&p.frames);
+	queue_free(&p.empty);
+	queue_free(&p.images);
+	
 	return(0);
 }
 
@@ -969,12 +2114,12 @@ int fswc_usage()
 	       "     --revert                 Restores original captured image.\n"
 	       "     --flip <direction>       Flips the image. (h, v)\n"
 	       "     --crop <size>[,<offset>] Crop a part of the image.\n"
-	       "     --scale <size>           Scales the image.\n"
+	       "     --scale <size>[,<filter>] Scales the image. (box, bilinear, lanczos)\n"
 	       "     --rotate <angle>         Rotates the image in right angles.\n"
 	       "     --deinterlace            Reduces interlace artifacts.\n"
 	       "     --invert                 Inverts the images colours.\n"
 	       "     --greyscale              Removes colour from the image.\n"
-		   " --interval <number>      Time between taking two images."
+	       "     --interval <usec>        Time between two shots, in microseconds.\n"
 	       "     --swapchannels <c1c2>    Swap channels c1 and c2.\n"
 	       "     --no-banner              Hides the banner.\n"
 	       "     --top-banner             Puts the banner at the top.\n"
@@ -1001,6 +2146,24 @@ int fswc_usage()
 	       "     --jpeg <factor>          Outputs a JPEG image. (-1, 0 - 95)\n"
 	       "     --png <factor>           Outputs a PNG image. (-1, 0 - 10)\n"
 	       "     --save <filename>        Save image to file.\n"
+	       "     --passthrough            Save unmodified JPEG frames as captured. (Default)\n"
+	       "     --no-passthrough         Always decode and re-encode JPEG frames.\n"
+	       "     --pipeline               Capture, process and encode on separate threads.\n"
+	       "     --threads <number>       Threads used to process images. 0 uses all CPUs.\n"
+	       "     --jpeg-fast-decode       Faster, less accurate decoding of JPEG frames.\n"
+	       "     --jpeg-subsample <mode>  JPEG chroma subsampling. (auto, 444, 422, 420)\n"
+	       "     --jpeg-optimize          Optimise the JPEG Huffman tables.\n"
+	       "     --no-jpeg-optimize       Use the standard Huffman tables. (Default)\n"
+	       "     --jpeg-progressive       Write progressive JPEG images.\n"
+	       "     --no-jpeg-progressive    Write baseline JPEG images. (Default)\n"
+	       "     --jpeg-dct <method>      JPEG DCT method. (islow, ifast, float)\n"
+	       "     --jpeg-restart <rows>    JPEG restart interval in MCU rows.\n"
+	       "     --jpeg-slices <number>   Encode JPEG images in parallel slices.\n"
+	       "     --write-queue <number>   Images waiting to be saved in the background.\n"
+	       "     --write-policy <policy>  When the write queue is full. (block, drop-oldest,\n"
+	       "                              drop-newest)\n"
+	       "     --write-sync <number>    Flush saved images to disk every <number> files.\n"
+	       "     --stats <filename>       Write the stage timings to a file as JSON.\n"
 	       "     --exec <command>         Execute a command and wait for it to complete.\n"
 	       "\n");
 
@@ -1078,6 +2241,23 @@ int fswc_getopts(fswebcam_config_t *config, int argc, char *argv[])
 			{"png",             required_argument, 0, OPT_PNG},
 			{"save",            required_argument, 0, OPT_SAVE},
 			{"exec",            required_argument, 0, OPT_EXEC},
+			{"passthrough",     no_argument,       0, OPT_PASSTHROUGH},
+			{"no-passthrough",  no_argument,       0, OPT_NO_PASSTHROUGH},
+			{"pipeline",        no_argument,       0, OPT_PIPELINE},
+			{"threads",         required_argument, 0, OPT_THREADS},
+			{"jpeg-fast-decode", no_argument,      0, OPT_JPEG_FAST_DECODE},
+			{"jpeg-subsample",  required_argument, 0, OPT_JPEG_SUBSAMPLE},
+			{"jpeg-optimize",   no_argument,       0, OPT_JPEG_OPTIMIZE},
+			{"no-jpeg-optimize", no_argument,      0, OPT_NO_JPEG_OPTIMIZE},
+			{"jpeg-progressive", no_argument,      0, OPT_JPEG_PROGRESSIVE},
+			{"no-jpeg-progressive", no_argument,   0, OPT_NO_JPEG_PROGRESSIVE},
+			{"jpeg-dct",        required_argument, 0, OPT_JPEG_DCT},
+			{"jpeg-restart",    required_argument, 0, OPT_JPEG_RESTART},
+			{"jpeg-slices",     required_argument, 0, OPT_JPEG_SLICES},
+			{"write-queue",     required_argument, 0, OPT_WRITE_QUEUE},
+			{"write-policy",    required_argument, 0, OPT_WRITE_POLICY},
+			{"write-sync",      required_argument, 0, OPT_WRITE_SYNC},
+			{"stats",           required_argument, 0, OPT_STATS},
 			{0, 0, 0, 0}
 		};
 		char *opts = "-qc:vl:bL:d:i:t:f:D:r:F:s:S:p:R";
@@ -1250,6 +2430,136 @@ int fswc_getopts(fswebcam_config_t *config, int argc, char *argv[])
 			free(config->save);
 			config->save = strdup(optarg);
 			break;
+		case OPT_NO_BANNER:
+			config->banner = NO_BANNER;
+			break;
+		case OPT_TOP_BANNER:
+			config->banner = TOP_BANNER;
+			break;
+		case OPT_BOTTOM_BANNER:
+			config->banner = BOTTOM_BANNER;
+			break;
+		case OPT_BG_COLOUR:
+			if(sscanf(optarg, "#%X", &config->bg_colour) != 1)
+				WARN("Bad background colour: %s", optarg);
+			break;
+		case OPT_BL_COLOUR:
+			if(sscanf(optarg, "#%X", &config->bl_colour) != 1)
+				WARN("Bad line colour: %s", optarg);
+			break;
+		case OPT_FG_COLOUR:
+			if(sscanf(optarg, "#%X", &config->fg_colour) != 1)
+				WARN("Bad text colour: %s", optarg);
+			break;
+		case OPT_FONT:
+			if(parse_font(optarg, &config->font, &config->fontsize))
+				WARN("Bad font: %s", optarg);
+			break;
+		case OPT_NO_SHADOW:
+			config->shadow = 0;
+			break;
+		case OPT_SHADOW:
+			config->shadow = 1;
+			break;
+		case OPT_NO_TITLE:
+			free(config->title);
+			config->title = NULL;
+			break;
+		case OPT_NO_SUBTITLE:
+			free(config->subtitle);
+			config->subtitle = NULL;
+			break;
+		case OPT_TIMESTAMP:
+			free(config->timestamp);
+			config->timestamp = strdup(optarg);
+			break;
+		case OPT_NO_TIMESTAMP:
+			free(config->timestamp);
+			config->timestamp = NULL;
+			break;
+		case OPT_NO_INFO:
+			free(config->info);
+			config->info = NULL;
+			break;
+		case OPT_UNDERLAY:
+			free(config->underlay);
+			config->underlay = strdup(optarg);
+			break;
+		case OPT_NO_UNDERLAY:
+			free(config->underlay);
+			config->underlay = NULL;
+			break;
+		case OPT_OVERLAY:
+			free(config->overlay);
+			config->overlay = strdup(optarg);
+			break;
+		case OPT_NO_OVERLAY:
+			free(config->overlay);
+			config->overlay = NULL;
+			break;
+		case OPT_JPEG:
+			MSG("Setting output format to JPEG, quality %i", atoi(optarg));
+			config->format = FORMAT_JPEG;
+			config->compression = atoi(optarg);
+			config->quality_set = 1;
+			break;
+		case OPT_PASSTHROUGH:
+			config->passthrough = 1;
+			break;
+		case OPT_NO_PASSTHROUGH:
+			config->passthrough = 0;
+			break;
+		case OPT_PIPELINE:
+			config->pipeline = 1;
+			break;
+		case OPT_THREADS:
+			config->threads = atoi(optarg);
+			break;
+		case OPT_JPEG_FAST_DECODE:
+			config->jpeg_fast = 1;
+			break;
+		case OPT_JPEG_SUBSAMPLE:
+			if(fswc_jpeg_subsample(&config->jpeg, optarg)) return(-1);
+			break;
+		case OPT_JPEG_OPTIMIZE:
+			config->jpeg.optimize = 1;
+			break;
+		case OPT_NO_JPEG_OPTIMIZE:
+			config->jpeg.optimize = 0;
+			break;
+		case OPT_JPEG_PROGRESSIVE:
+			config->jpeg.progressive = 1;
+			break;
+		case OPT_NO_JPEG_PROGRESSIVE:
+			config->jpeg.progressive = 0;
+			break;
+		case OPT_JPEG_DCT:
+			if(fswc_jpeg_dct(&config->jpeg, optarg)) return(-1);
+			break;
+		case OPT_JPEG_RESTART:
+			config->jpeg.restart = atoi(optarg);
+			if(config->jpeg.restart < 0) config->jpeg.restart = 0;
+			break;
+		case OPT_JPEG_SLICES:
+			config->jpeg.slices = atoi(optarg);
+			if(config->jpeg.slices < 0) config->jpeg.slices = 1;
+			break;
+		case OPT_WRITE_QUEUE:
+			config->write_queue = atoi(optarg);
+			if(config->write_queue < 0) config->write_queue = 0;
+			break;
+		case OPT_WRITE_POLICY:
+			config->write_policy = writer_policy(optarg);
+			if(config->write_policy < 0) return(-1);
+			break;
+		case OPT_WRITE_SYNC:
+			config->write_sync = atoi(optarg);
+			if(config->write_sync < 0) config->write_sync = 0;
+			break;
+		case OPT_STATS:
+			free(config->stats);
+			config->stats = strdup(optarg);
+			break;
 		default:
 			/* All other options are added to the job queue. */
 			fswc_add_job(config, c, optarg);
@@ -1296,6 +2606,7 @@ int fswc_free_config(fswebcam_config_t *config)
 	free(config->underlay);
 	free(config->overlay);
 	free(config->filename);
+	free(config->stats);
 	
 	src_free_options(&config->option);
 	//fswc_free_jobs(config);
@@ -1305,34 +2616,22 @@ int fswc_free_config(fswebcam_config_t *config)
 	return(0);
 }
 
-//this integer for image name
-int main(int argc, char *argv[])
+/* A configuration with the default values for this run, and the
+ * command line applied. Returns NULL on error. */
+fswebcam_config_t *fswc_config_new(int argc, char *argv[])
 {
-	
 	fswebcam_config_t *config;
-
+	
 	/* Prepare the configuration structure. */
 	config = calloc(sizeof(fswebcam_config_t), 1);
 
 	if(!config)
 	{
 		WARN("Out of memory.");
-		return(-1);
+		return(NULL);
 	}
-
-
-//	config->width  = src.width;
-//	config->height = src.height;
+	
 	/* Set the default values for this run. */
-	if(config->font) free(config->font);
-	if(config->title) free(config->title);
-	if(config->subtitle) free(config->subtitle);
-	if(config->timestamp) free(config->timestamp);
-	if(config->info) free(config->info);
-	if(config->underlay) free(config->underlay);
-	if(config->overlay) free(config->overlay);
-	if(config->filename) free(config->filename);
-
 	config->banner       = BOTTOM_BANNER;
 	config->bg_colour    = 0x40263A93;
 	config->bl_colour    = 0x00FF0000;
@@ -1349,14 +2648,47 @@ int main(int argc, char *argv[])
 	config->filename     = NULL;
 	config->format       = FORMAT_JPEG;
 	config->compression  = -1;
-
+	config->quality_set  = 0;
+	config->passthrough  = 1;
+	config->threads      = 1;
+	config->jpeg_fast    = 0;
+	fswc_jpeg_defaults(&config->jpeg);
+	config->write_queue  = 4;
+	config->write_policy = WRITER_BLOCK;
+	config->write_sync   = 0;
+	config->stats        = NULL;
+	
 	MSG("Setting output format to JPEG, quality %i", 90);
 	config->format = FORMAT_JPEG;
 	config->compression = 90;
+	
+	/* Parse the command line. */
+	if(fswc_getopts(config, argc, argv))
+	{
+		fswc_config_free(config);
+		return(NULL);
+	}
+	
+	return(config);
+}
 
-	/* Set defaults and parse the command line. */
-	if(fswc_getopts(config, argc, argv)) return(-1);
+void fswc_config_free(fswebcam_config_t *config)
+{
+	fswc_free_config(config);
+	free(config);
+}
+
+#ifndef FSWC_NO_MAIN
 
+//this integer for image name
+int main(int argc, char *argv[])
+{
+	fswebcam_config_t *config;
+	
+	/* Set defaults and parse the command line. */
+	config = fswc_config_new(argc, argv);
+	if(!config) return(-1);
+	
 	/* Open the log file if one was specified. */
 	if(config->logfile && fswc_openlog(config)) return(-1);
 
@@ -1371,17 +2703,33 @@ int main(int argc, char *argv[])
 	
 	/* Enable FontConfig support in GD */
 	if(!gdFTUseFontConfig(1)) DEBUG("gd has no fontconfig support");
+	/* Start the decoder threads. */
+	if(pool_init(config->threads)) return(-1);
+	
+	/* Start the writer thread. */
+	if(writer_init(config->write_queue, config->write_policy,
+	               config->write_sync)) return(-1);
+	
 	/* Capture the image(s). */
 	/* Capture the image. */
-	fswc_grab(config);
-
+	if(config->pipeline) fswc_pipeline(config);
+	else fswc_grab(config);
+	
+	writer_free();
+	pool_free();
+	fbpool_free();
+	stats_report(config->stats);
+	overlay_free(&fswc_underlay);
+	overlay_free(&fswc_overlay);
+	
 	/* Close the log file. */
 	if(config->logfile) log_close();
 	
 	/* Free all used memory. */
-	fswc_free_config(config);
-	free(config);
+	fswc_config_free(config);
 	
 	return(0);
 }
 
+#endif
+
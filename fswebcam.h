@@ -32,4 +32,16 @@ typedef uint16_t avgbmp_t;
 
 #define CLIP(val, min, max) (((val) > (max)) ? (max) : (((val) < (min)) ? (min) : (val)))
 
+/* The capture is driven from outside fswebcam.c only by
+ * fswebcam-bench, which builds it without main(). */
+typedef struct fswebcam_config fswebcam_config_t;
+
+/* Defaults with the command line applied, or NULL on error. */
+extern fswebcam_config_t *fswc_config_new(int argc, char *argv[]);
+extern void fswc_config_free(fswebcam_config_t *config);
+
+/* Take shots from the configured source without saving them. Returns
+ * the number taken, or -1 if the source couldn't be opened. */
+extern int fswc_bench_shots(fswebcam_config_t *config, int shots);
+
 #endif
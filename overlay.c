@@ -0,0 +1,330 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2011 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <gd.h>
+#include "overlay.h"
+#include "log.h"
+
+/* Drawing onto an opaque pixel, gdAlphaBlend() works out
+ *
+ *   (src * (gdAlphaMax - alpha) + dst * alpha) / gdAlphaMax
+ *
+ * for each channel. The first half is worked out when the image is
+ * loaded. x * 0x8103 >> 22 is x / 127 for every x up to 255 * 127.
+ * Pixels are blended four at a time using GCC vector types, which
+ * become SSE2 or NEON instructions. */
+
+#define OVERLAY_DIV127(x) (((x) * 0x8103) >> 22)
+
+typedef uint32_t v4u __attribute__ ((vector_size (16)));
+
+static inline v4u ov_load(const uint32_t *p)
+{
+	v4u v;
+	memcpy(&v, p, sizeof(v));
+	return(v);
+}
+
+static inline void ov_store(uint32_t *p, v4u v)
+{
+	memcpy(p, &v, sizeof(v));
+}
+
+static inline uint32_t overlay_blend_px(uint32_t d, uint32_t rb, uint32_t ga)
+{
+	uint32_t a = ga & 0xFFFF;
+	uint32_t r = OVERLAY_DIV127((rb >> 16) + ((d >> 16) & 0xFF) * a);
+	uint32_t g = OVERLAY_DIV127((ga >> 16) + ((d >> 8) & 0xFF) * a);
+	uint32_t b = OVERLAY_DIV127((rb & 0xFFFF) + (d & 0xFF) * a);
+	
+	return((r << 16) | (g << 8) | b);
+}
+
+static void overlay_blend_span(uint32_t *dst, const uint32_t *pixel,
+                               const uint32_t *rb, const uint32_t *ga,
+                               int length)
+{
+	int i = 0;
+	
+	for(; i + 4 <= length; i += 4)
+	{
+		v4u d  = ov_load(dst + i);
+		v4u vr = ov_load(rb + i);
+		v4u vg = ov_load(ga + i);
+		v4u a, r, g, b, t;
+		
+		/* The shortcut only holds for opaque pixels. */
+		t = d >> 24;
+		if(t[0] | t[1] | t[2] | t[3])
+		{
+			int j;
+			
+			for(j = i; j < i + 4; j++)
+				dst[j] = gdAlphaBlend(dst[j], pixel[j]);
+			
+			continue;
+		}
+		
+		a = vg & 0xFFFF;
+		r = OVERLAY_DIV127((vr >> 16) + ((d >> 16) & 0xFF) * a);
+		g = OVERLAY_DIV127((vg >> 16) + ((d >> 8) & 0xFF) * a);
+		b = OVERLAY_DIV127((vr & 0xFFFF) + (d & 0xFF) * a);
+		
+		ov_store(dst + i, (r << 16) | (g << 8) | b);
+	}
+	
+	for(; i < length; i++)
+	{
+		if(dst[i] >> 24) dst[i] = gdAlphaBlend(dst[i], pixel[i]);
+		else dst[i] = overlay_blend_px(dst[i], rb[i], ga[i]);
+	}
+}
+
+/* The truecolour value gdImageCopy() would draw, or -1 if it would
+ * leave the pixel as it is. */
+static int64_t overlay_pixel(gdImage *im, int x, int y)
+{
+	int c;
+	
+	if(gdImageTrueColor(im))
+	{
+		c = gdImageTrueColorPixel(im, x, y);
+		if(c == gdImageGetTransparent(im)) return(-1);
+	}
+	else
+	{
+		c = gdImagePalettePixel(im, x, y);
+		if(c == gdImageGetTransparent(im)) return(-1);
+		
+		c = gdTrueColorAlpha(gdImageRed(im, c), gdImageGreen(im, c),
+		                     gdImageBlue(im, c), gdImageAlpha(im, c));
+	}
+	
+	if(gdTrueColorGetAlpha(c) == gdAlphaTransparent) return(-1);
+	
+	return(c);
+}
+
+static void overlay_clear(overlay_t *o)
+{
+	free(o->span);
+	free(o->pixel);
+	free(o->rb);
+	free(o->ga);
+	
+	o->span  = NULL;
+	o->pixel = NULL;
+	o->rb    = NULL;
+	o->ga    = NULL;
+	o->spans = 0;
+	o->loaded = 0;
+}
+
+static int overlay_load(overlay_t *o, char *filename)
+{
+	FILE *f;
+	gdImage *im;
+	overlay_span_t *span;
+	uint32_t *pixel, *rb, *ga;
+	int spans, pixels;
+	int x, y, n;
+	
+	f = fopen(filename, "rb");
+	if(!f)
+	{
+		ERROR("Unable to open '%s'", filename);
+		ERROR("fopen: %s", strerror(errno));
+		return(-1);
+	}
+	
+	im = gdImageCreateFromPng(f);
+	fclose(f);
+	
+	if(!im)
+	{
+		ERROR("Unable to read '%s'. Not a PNG image?", filename);
+		return(-1);
+	}
+	
+	/* Count the runs of pixels that will be drawn. */
+	spans = pixels = 0;
+	for(y = 0; y < gdImageSY(im); y++)
+	{
+		int run = 0;
+		
+		for(x = 0; x < gdImageSX(im); x++)
+		{
+			if(overlay_pixel(im, x, y) < 0) run = 0;
+			else
+			{
+				if(!run) spans++;
+				run = 1;
+				pixels++;
+			}
+		}
+	}
+	
+	span  = malloc(sizeof(overlay_span_t) * (spans ? spans : 1));
+	pixel = malloc(sizeof(uint32_t) * (pixels ? pixels : 1));
+	rb    = malloc(sizeof(uint32_t) * (pixels ? pixels : 1));
+	ga    = malloc(sizeof(uint32_t) * (pixels ? pixels : 1));
+	
+	if(!span || !pixel || !rb || !ga)
+	{
+		ERROR("Out of memory.");
+		free(span);
+		free(pixel);
+		free(rb);
+		free(ga);
+		gdImageDestroy(im);
+		return(-1);
+	}
+	
+	spans = n = 0;
+	for(y = 0; y < gdImageSY(im); y++)
+	{
+		overlay_span_t *s = NULL;
+		
+		for(x = 0; x < gdImageSX(im); x++)
+		{
+			int64_t c = overlay_pixel(im, x, y);
+			uint32_t a;
+			
+			if(c < 0)
+			{
+				s = NULL;
+				continue;
+			}
+			
+			if(!s)
+			{
+				s = &span[spans++];
+				s->y = y;
+				s->x = x;
+				s->length = 0;
+				s->offset = n;
+			}
+			
+			a = gdTrueColorGetAlpha(c);
+			
+			pixel[n] = c;
+			rb[n] = (gdTrueColorGetRed(c) * (gdAlphaMax - a)) << 16 |
+			        (gdTrueColorGetBlue(c) * (gdAlphaMax - a));
+			ga[n] = (gdTrueColorGetGreen(c) * (gdAlphaMax - a)) << 16 | a;
+			
+			s->length++;
+			n++;
+		}
+	}
+	
+	overlay_clear(o);
+	
+	o->width  = gdImageSX(im);
+	o->height = gdImageSY(im);
+	o->span   = span;
+	o->spans  = spans;
+	o->pixel  = pixel;
+	o->rb     = rb;
+	o->ga     = ga;
+	o->loaded = 1;
+	
+	gdImageDestroy(im);
+	
+	DEBUG("Loaded '%s', %ix%i, %i of %i pixels drawn.", filename,
+	      o->width, o->height, pixels, o->width * o->height);
+	
+	return(0);
+}
+
+void overlay_free(overlay_t *o)
+{
+	overlay_clear(o);
+	free(o->filename);
+	o->filename = NULL;
+}
+
+void overlay_reload(overlay_t *o)
+{
+	o->stale = 1;
+}
+
+int overlay_draw(overlay_t *o, char *filename, gdImage *im)
+{
+	struct stat st;
+	long mtime_ns = 0;
+	int i;
+	
+	if(!filename) return(-1);
+	
+	if(stat(filename, &st))
+	{
+		ERROR("Unable to open '%s'", filename);
+		ERROR("stat: %s", strerror(errno));
+		return(-1);
+	}
+	
+#ifdef __linux__
+	mtime_ns = st.st_mtim.tv_nsec;
+#endif
+	
+	if(o->stale || !o->filename || strcmp(o->filename, filename) ||
+	   o->dev != st.st_dev || o->ino != st.st_ino ||
+	   o->size != st.st_size || o->mtime != st.st_mtime ||
+	   o->mtime_ns != mtime_ns)
+	{
+		int same = (o->filename && !strcmp(o->filename, filename));
+		
+		/* Remember this version either way, a file that can't be
+		 * read is tried again when it next changes. */
+		o->dev      = st.st_dev;
+		o->ino      = st.st_ino;
+		o->size     = st.st_size;
+		o->mtime    = st.st_mtime;
+		o->mtime_ns = mtime_ns;
+		o->stale    = 0;
+		
+		if(!same)
+		{
+			overlay_clear(o);
+			free(o->filename);
+			o->filename = strdup(filename);
+		}
+		
+		if(overlay_load(o, filename) && o->loaded)
+			WARN("Using the previous version of '%s'.", filename);
+	}
+	
+	if(!o->loaded) return(-1);
+	
+	for(i = 0; i < o->spans; i++)
+	{
+		overlay_span_t *s = &o->span[i];
+		int length = s->length;
+		
+		if(s->y >= gdImageSY(im)) break;
+		if(s->x >= gdImageSX(im)) continue;
+		if(s->x + length > gdImageSX(im)) length = gdImageSX(im) - s->x;
+		
+		overlay_blend_span((uint32_t *) im->tpixels[s->y] + s->x,
+		                   o->pixel + s->offset, o->rb + s->offset,
+		                   o->ga + s->offset, length);
+	}
+	
+	return(0);
+}
+
@@ -0,0 +1,71 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2011 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+#ifndef INC_OVERLAY_H
+#define INC_OVERLAY_H
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include <gd.h>
+
+/* A PNG image drawn over (or under) every shot. The file is decoded
+ * once and kept as runs of pixels that aren't fully transparent, with
+ * the colour already multiplied by its alpha. It's decoded again only
+ * when the file changes or overlay_reload() is called. */
+
+typedef struct {
+	int y;
+	int x;
+	int length;
+	int offset; /* Of the first pixel in the arrays below */
+} overlay_span_t;
+
+typedef struct {
+	
+	char *filename;
+	
+	/* The version of the file that was loaded. */
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+	long mtime_ns;
+	
+	char stale;
+	
+	/* Set if an image has been loaded. */
+	char loaded;
+	
+	int width;
+	int height;
+	
+	overlay_span_t *span;
+	int spans;
+	
+	/* For each pixel, the original colour and the premultiplied
+	 * channels: red << 16 | blue, and green << 16 | alpha. */
+	uint32_t *pixel;
+	uint32_t *rb;
+	uint32_t *ga;
+	
+} overlay_t;
+
+/* An overlay_t starts zeroed, and is emptied by overlay_free(). */
+extern void overlay_free(overlay_t *o);
+
+/* Decode the file again before it's next drawn, even if unchanged. */
+extern void overlay_reload(overlay_t *o);
+
+/* Blends the image in filename onto im at 0,0 as gdImageCopy() would,
+ * loading it first if it isn't cached or has changed. */
+extern int overlay_draw(overlay_t *o, char *filename, gdImage *im);
+
+#endif
+
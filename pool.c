@@ -0,0 +1,180 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2011 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "pool.h"
+#include "log.h"
+
+static struct {
+	
+	pthread_t *thread;
+	int threads;
+	
+	/* Held by the thread running a job. */
+	pthread_mutex_t busy;
+	
+	/* Protects everything below. */
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	
+	/* The current job. A new job bumps the generation. */
+	pool_fn_t fn;
+	void *arg;
+	int parts;
+	int next;
+	int finished;
+	unsigned int generation;
+	
+	char stop;
+	
+} pool;
+
+/* Take parts of the current job until there are none left. Called
+ * with the lock held, which is released while a part runs. */
+static void pool_work(void)
+{
+	while(pool.next < pool.parts)
+	{
+		pool_fn_t fn = pool.fn;
+		void *arg = pool.arg;
+		int part = pool.next++;
+		
+		pthread_mutex_unlock(&pool.lock);
+		fn(arg, part);
+		pthread_mutex_lock(&pool.lock);
+		
+		if(++pool.finished == pool.parts)
+			pthread_cond_signal(&pool.done);
+	}
+}
+
+static void *pool_worker(void *arg)
+{
+	unsigned int seen = 0;
+	
+	pthread_mutex_lock(&pool.lock);
+	
+	while(1)
+	{
+		while(seen == pool.generation && !pool.stop)
+			pthread_cond_wait(&pool.start, &pool.lock);
+		
+		if(pool.stop) break;
+		
+		seen = pool.generation;
+		pool_work();
+	}
+	
+	pthread_mutex_unlock(&pool.lock);
+	
+	return(NULL);
+}
+
+int pool_init(int threads)
+{
+	int i;
+	
+	if(threads <= 0) threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if(threads <= 0) threads = 1;
+	
+	memset(&pool, 0, sizeof(pool));
+	pthread_mutex_init(&pool.busy, NULL);
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.start, NULL);
+	pthread_cond_init(&pool.done, NULL);
+	
+	pool.threads = 1;
+	if(threads == 1) return(0);
+	
+	pool.thread = calloc(threads - 1, sizeof(pthread_t));
+	if(!pool.thread)
+	{
+		ERROR("Out of memory.");
+		return(-1);
+	}
+	
+	for(i = 0; i < threads - 1; i++)
+	{
+		if(pthread_create(&pool.thread[i], NULL, pool_worker, NULL))
+		{
+			WARN("Unable to start more than %i threads.", pool.threads);
+			break;
+		}
+		
+		pool.threads++;
+	}
+	
+	DEBUG("Using %i threads.", pool.threads);
+	
+	return(0);
+}
+
+void pool_free(void)
+{
+	int i;
+	
+	if(!pool.threads) return;
+	
+	pthread_mutex_lock(&pool.lock);
+	pool.stop = 1;
+	pthread_cond_broadcast(&pool.start);
+	pthread_mutex_unlock(&pool.lock);
+	
+	for(i = 0; i < pool.threads - 1; i++)
+		pthread_join(pool.thread[i], NULL);
+	
+	free(pool.thread);
+	pool.thread = NULL;
+	pool.threads = 1;
+}
+
+int pool_threads(void)
+{
+	return(pool.threads > 1 ? pool.threads : 1);
+}
+
+void pool_run(int parts, pool_fn_t fn, void *arg)
+{
+	int i;
+	
+	/* Run the job here if there's no one to share it with. */
+	if(pool.threads <= 1 || parts <= 1 ||
+	   pthread_mutex_trylock(&pool.busy))
+	{
+		for(i = 0; i < parts; i++) fn(arg, i);
+		return;
+	}
+	
+	pthread_mutex_lock(&pool.lock);
+	
+	pool.fn       = fn;
+	pool.arg      = arg;
+	pool.parts    = parts;
+	pool.next     = 0;
+	pool.finished = 0;
+	pool.generation++;
+	pthread_cond_broadcast(&pool.start);
+	
+	/* Help out, then wait for the workers to finish. */
+	pool_work();
+	while(pool.finished < pool.parts)
+		pthread_cond_wait(&pool.done, &pool.lock);
+	
+	pthread_mutex_unlock(&pool.lock);
+	pthread_mutex_unlock(&pool.busy);
+}
+
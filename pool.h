@@ -0,0 +1,33 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2011 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+#ifndef INC_POOL_H
+#define INC_POOL_H
+
+/* A small pool of worker threads for splitting one job (usually an
+ * image) into parts. There is only one pool, set up by pool_init().
+ * Without it, or while another thread is using it, pool_run() simply
+ * runs every part on the calling thread. */
+
+typedef void (*pool_fn_t)(void *arg, int part);
+
+/* Starts threads - 1 workers, the caller of pool_run() is the last.
+ * 0 starts one thread for each online CPU. */
+extern int pool_init(int threads);
+extern void pool_free(void);
+
+/* Number of threads that pool_run() can use. */
+extern int pool_threads(void);
+
+/* Calls fn(arg, part) for each part 0 .. parts - 1 and returns when
+ * they have all finished. */
+extern void pool_run(int parts, pool_fn_t fn, void *arg);
+
+#endif
+
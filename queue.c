@@ -0,0 +1,123 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2011 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "queue.h"
+#include "log.h"
+
+int queue_init(queue_t *q, uint32_t size, int policy)
+{
+	uint32_t s;
+	
+	/* Round the size up to a power of two. */
+	for(s = 1; s < size; s <<= 1);
+	
+	memset(q, 0, sizeof(queue_t));
+	
+	q->slot = calloc(s, sizeof(void *));
+	if(!q->slot)
+	{
+		ERROR("Out of memory.");
+		return(-1);
+	}
+	
+	q->size   = s;
+	q->policy = policy;
+	
+	sem_init(&q->items, 0, 0);
+	sem_init(&q->spaces, 0, s);
+	
+	return(0);
+}
+
+void queue_free(queue_t *q)
+{
+	sem_destroy(&q->items);
+	sem_destroy(&q->spaces);
+	free(q->slot);
+	
+	memset(q, 0, sizeof(queue_t));
+}
+
+int queue_push(queue_t *q, void *item)
+{
+	uint32_t tail;
+	
+	if(q->closed) return(-1);
+	
+	if(q->policy == QUEUE_DROP)
+	{
+		if(sem_trywait(&q->spaces))
+		{
+			__atomic_add_fetch(&q->dropped, 1, __ATOMIC_RELAXED);
+			return(-1);
+		}
+	}
+	else while(sem_wait(&q->spaces) && errno == EINTR);
+	
+	/* Publish the item before moving the tail past it. */
+	tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+	q->slot[tail & (q->size - 1)] = item;
+	__atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&q->pushed, 1, __ATOMIC_RELAXED);
+	
+	sem_post(&q->items);
+	
+	return(0);
+}
+
+void *queue_pop(queue_t *q, int wait)
+{
+	uint32_t head;
+	void *item;
+	
+	if(!wait)
+	{
+		if(sem_trywait(&q->items)) return(NULL);
+	}
+	else while(sem_wait(&q->items) && errno == EINTR);
+	
+	head = q->head;
+	
+	if(__atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) == head)
+	{
+		/* This was the wake-up from queue_close(). Leave
+		 * it for the next call. */
+		sem_post(&q->items);
+		return(NULL);
+	}
+	
+	item = q->slot[head & (q->size - 1)];
+	__atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+	
+	sem_post(&q->spaces);
+	
+	return(item);
+}
+
+void queue_close(queue_t *q)
+{
+	q->closed = 1;
+	
+	/* Wake the consumer if it's waiting on an empty queue. */
+	sem_post(&q->items);
+}
+
+uint32_t queue_depth(queue_t *q)
+{
+	return(__atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) -
+	       __atomic_load_n(&q->head, __ATOMIC_ACQUIRE));
+}
+
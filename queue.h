@@ -0,0 +1,64 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2011 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+#include <stdint.h>
+#include <semaphore.h>
+
+#ifndef INC_QUEUE_H
+#define INC_QUEUE_H
+
+/* What queue_push() does when the queue is full. */
+#define QUEUE_BLOCK (0) /* Wait for the consumer to make room */
+#define QUEUE_DROP  (1) /* Fail, the caller keeps the item */
+
+/* A bounded single-producer, single-consumer queue of pointers.
+ * Exactly one thread may push and one thread may pop. The ring
+ * itself is lock-free, the semaphores are only used to sleep
+ * while the queue is empty or full. */
+
+typedef struct {
+	
+	void **slot;
+	uint32_t size; /* Power of two */
+	
+	/* Only written by the consumer and producer respectively. */
+	volatile uint32_t head;
+	volatile uint32_t tail;
+	
+	sem_t items;
+	sem_t spaces;
+	
+	int policy;
+	volatile char closed;
+	
+	/* Statistics. */
+	volatile uint32_t pushed;
+	volatile uint32_t dropped;
+	
+} queue_t;
+
+extern int queue_init(queue_t *q, uint32_t size, int policy);
+extern void queue_free(queue_t *q);
+
+/* Returns 0 if the item was queued, or -1 if the queue is full (with
+ * QUEUE_DROP) or closed. */
+extern int queue_push(queue_t *q, void *item);
+
+/* Returns the next item, waiting for one if wait is set. Returns NULL
+ * if the queue is empty and either wait is not set or it is closed. */
+extern void *queue_pop(queue_t *q, int wait);
+
+/* Wakes the consumer. Items already queued can still be popped. */
+extern void queue_close(queue_t *q);
+
+/* Number of items waiting in the queue. */
+extern uint32_t queue_depth(queue_t *q);
+
+#endif
+
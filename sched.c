@@ -0,0 +1,123 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2011 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "sched.h"
+#include "log.h"
+
+#define NSEC (1000000000LL)
+
+static int64_t sched_ns(struct timespec *t)
+{
+	return((int64_t) t->tv_sec * NSEC + t->tv_nsec);
+}
+
+static void sched_set(struct timespec *t, int64_t ns)
+{
+	t->tv_sec  = ns / NSEC;
+	t->tv_nsec = ns % NSEC;
+}
+
+void sched_init(sched_t *s, long period, long loop, long offset)
+{
+	struct timespec now, wall;
+	int64_t next, w;
+	
+	memset(s, 0, sizeof(sched_t));
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	s->next = now;
+	
+	if(loop > 0) s->period = (int64_t) loop * NSEC;
+	else if(period > 0) s->period = (int64_t) period * 1000;
+	else return;
+	
+	if(loop <= 0) return;
+	
+	/* Find the next wall clock boundary and how far off it is. Later
+	 * deadlines follow on from it in CLOCK_MONOTONIC, which isn't
+	 * moved by changes to the system time. */
+	clock_gettime(CLOCK_REALTIME, &wall);
+	w = sched_ns(&wall) - (int64_t) offset * NSEC;
+	next = (w / s->period + 1) * s->period - w;
+	
+	sched_set(&s->next, sched_ns(&now) + next);
+	
+	DEBUG("First shot is due in %.3f seconds.", (double) next / NSEC);
+}
+
+int sched_due(sched_t *s)
+{
+	struct timespec now;
+	
+	if(!s->period) return(1);
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	
+	return(sched_ns(&now) >= sched_ns(&s->next));
+}
+
+int sched_wait(sched_t *s)
+{
+	int r;
+	
+	if(!s->period) return(0);
+	
+	r = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &s->next, NULL);
+	if(r == EINTR) return(-1);
+	
+	return(0);
+}
+
+void sched_next(sched_t *s)
+{
+	struct timespec now;
+	int64_t late, missed;
+	
+	s->shots++;
+	if(!s->period) return;
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	late = sched_ns(&now) - sched_ns(&s->next);
+	
+	/* A shot taken early, by SIGUSR1, keeps the deadline. */
+	if(late < 0) return;
+	
+	if(late > s->late_max) s->late_max = late;
+	s->late_total += late;
+	
+	/* Skip any deadlines that were missed completely. */
+	missed = late / s->period;
+	if(missed)
+	{
+		DEBUG("Running late, skipping %lli shots.", (long long) missed);
+		s->skipped += missed;
+	}
+	
+	sched_set(&s->next, sched_ns(&s->next) + (missed + 1) * s->period);
+	
+	DEBUG("Shot %u is %.3f ms late.", s->shots, (double) late / 1000000);
+}
+
+void sched_report(sched_t *s)
+{
+	if(!s->period || !s->shots) return;
+	
+	MSG("Schedule: %u shots, %u skipped, %.3f ms late on average, "
+	    "%.3f ms at most.", s->shots, s->skipped,
+	    (double) s->late_total / s->shots / 1000000,
+	    (double) s->late_max / 1000000);
+}
+
@@ -0,0 +1,55 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2011 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+#ifndef INC_SCHED_H
+#define INC_SCHED_H
+
+#include <stdint.h>
+#include <time.h>
+
+/* Times shots on fixed deadlines of CLOCK_MONOTONIC, so the time
+ * taken by each shot doesn't add to the period. A deadline that has
+ * already passed by a whole period is skipped, not made up. */
+
+typedef struct {
+	
+	struct timespec next; /* The next deadline */
+	int64_t period;       /* Nanoseconds, 0 for no schedule */
+	
+	/* Statistics. */
+	unsigned int shots;
+	unsigned int skipped;
+	int64_t late_total;
+	int64_t late_max;
+	
+} sched_t;
+
+/* Sets up a shot every period microseconds starting now. If loop is
+ * set the period is loop seconds instead, and the shots are lined up
+ * with the wall clock: one is due whenever the seconds since the epoch
+ * minus offset are a multiple of loop. Without either, every shot is
+ * due at once. */
+extern void sched_init(sched_t *s, long period, long loop, long offset);
+
+/* Returns 1 if the next shot is due. */
+extern int sched_due(sched_t *s);
+
+/* Sleeps until the next shot is due. Returns 0 when it is, or -1 if
+ * the sleep was interrupted by a signal. */
+extern int sched_wait(sched_t *s);
+
+/* Records how late the shot being taken is and moves on to the next
+ * deadline still in the future. */
+extern void sched_next(sched_t *s);
+
+/* Logs the number of shots, skipped deadlines and lateness. */
+extern void sched_report(sched_t *s);
+
+#endif
+
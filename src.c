@@ -202,19 +202,34 @@ int src_close(src_t *src)
 
 int src_grab(src_t *src)
 {
-	int r = src_mod[src->type]->grab(src);
+	int r;
+	
+	/* Defaults for sources that don't report their own. */
+	timerclear(&src->timestamp);
+	src->sequence = src->captured_frames;
+	
+	r = src_mod[src->type]->grab(src);
 	
 	if(!r)
 	{
 		if(!src->captured_frames) gettimeofday(&src->tv_first, NULL);
 		gettimeofday(&src->tv_last, NULL);
 		
+		if(!timerisset(&src->timestamp)) src->timestamp = src->tv_last;
+		
 		src->captured_frames++;
 	}
-	printf("----src_grab r=%d\n", r);
 	return(r);
 }
 
+int src_reset(src_t *src)
+{
+	/* Not all sources can recover without being reopened. */
+	if(!src_mod[src->type]->reset) return(-1);
+	
+	return(src_mod[src->type]->reset(src));
+}
+
 /* Pointers are great things. Terrible things yes, but great. */
 /* These work but are very ugly and will be re-written soon. */
 
@@ -71,8 +71,10 @@ typedef struct {
 	void *state;
 	
 	/* Last captured image */
-	uint32_t length;
+	uint32_t length; /* Bytes of valid image data */
 	void *img;
+	struct timeval timestamp;
+	uint32_t sequence;
 	
 	/* Input Options */
 	char    *input;
@@ -109,12 +111,14 @@ typedef struct {
 	int (*open)(src_t *);
 	int (*close)(src_t *);
 	int (*grab)(src_t *);
+	int (*reset)(src_t *);
 	
 } src_mod_t;
 
 extern int src_open(src_t *src, char *source);
 extern int src_close(src_t *src);
 extern int src_grab(src_t *src);
+extern int src_reset(src_t *src);
 
 extern int src_set_option(src_option_t ***options, char *name, char *value);
 extern int src_get_option_by_number(src_option_t **opt, int number, char **name, char **value);
@@ -252,6 +252,7 @@ src_mod_t src_file = {
 	"file", SRC_TYPE_FILE,
 	src_file_open,
 	src_file_close,
-	src_file_grab
+	src_file_grab,
+	NULL
 };
 
@@ -154,6 +154,7 @@ src_mod_t src_raw = {
 	"raw", SRC_TYPE_NONE,
 	src_raw_open,
 	src_raw_close,
-	src_raw_grab
+	src_raw_grab,
+	NULL
 };
 
@@ -12,31 +12,261 @@
 #endif
 
 #include <stdlib.h>
+#include <string.h>
+#include <gd.h>
 #include "src.h"
+#include "enc.h"
 #include "log.h"
 
 #define PUT_RGB(d, r, g, b) { d[0] = r; d[1] = g; d[2] = b; }
 
+#define CLIP8(v) ((v) < 0 ? 0 : ((v) > 0xFF ? 0xFF : (v)))
+
+/* The test image is drawn in RGB24 and then converted to the palette
+ * asked for, so every decoder can be run without a camera. The
+ * conversions are close to, not exact inverses of, the decoders. */
+
+static void src_test_yuv(uint8_t *p, int *y, int *u, int *v)
+{
+	*y = (77 * p[0] + 150 * p[1] + 29 * p[2]) >> 8;
+	*u = CLIP8((((p[2] - *y) * 144) >> 8) + 128);
+	*v = CLIP8((((p[0] - *y) * 183) >> 8) + 128);
+}
+
+/* Compress the test image as a JPEG or PNG file. */
+static int src_test_compress(src_t *src, uint8_t *rgb)
+{
+	fswc_jpeg_opts_t opts;
+	gdImage *im;
+	uint8_t *buf = NULL;
+	unsigned long len, size = 0;
+	uint32_t x, y;
+	
+	im = gdImageCreateTrueColor(src->width, src->height);
+	if(!im) return(-1);
+	
+	for(y = 0; y < src->height; y++)
+		for(x = 0; x < src->width; x++, rgb += 3)
+			im->tpixels[y][x] = (rgb[0] << 16) | (rgb[1] << 8) | rgb[2];
+	
+	if(src->palette == SRC_PAL_PNG)
+	{
+		uint8_t *png;
+		int l;
+		
+		/* gd's buffer has to be freed with gdFree(). */
+		png = gdImagePngPtr(im, &l);
+		if(png)
+		{
+			len = l;
+			buf = malloc(len);
+			if(buf) memcpy(buf, png, len);
+			gdFree(png);
+		}
+	}
+	else
+	{
+		fswc_jpeg_defaults(&opts);
+		opts.quality = 90;
+		
+		if(fswc_encode_jpeg_mem(im, &opts, &buf, &len, &size))
+		{
+			free(buf);
+			buf = NULL;
+		}
+	}
+	
+	gdImageDestroy(im);
+	
+	if(!buf) return(-1);
+	
+	src->img    = buf;
+	src->length = len;
+	
+	return(0);
+}
+
+static int src_test_convert(src_t *src, uint8_t *rgb)
+{
+	uint32_t w = src->width, h = src->height, n = w * h;
+	uint32_t x, y, i;
+	uint8_t *d, *p;
+	uint16_t *d16;
+	int cy, cu, cv;
+	
+	switch(src->palette)
+	{
+	case SRC_PAL_JPEG:
+	case SRC_PAL_MJPEG:
+	case SRC_PAL_PNG:
+		return(src_test_compress(src, rgb));
+	case SRC_PAL_RGB32:
+	case SRC_PAL_BGR32:
+		src->length = n * 4;
+		break;
+	case SRC_PAL_BGR24:
+		src->length = n * 3;
+		break;
+	case SRC_PAL_RGB565:
+	case SRC_PAL_RGB555:
+	case SRC_PAL_YUYV:
+	case SRC_PAL_UYVY:
+	case SRC_PAL_Y16:
+		src->length = n * 2;
+		break;
+	case SRC_PAL_NV12MB:
+		if((w & 0xF) || (h & 0x1F))
+		{
+			ERROR("NV12MB needs a width that is a multiple of 16 and a height that is a multiple of 32.");
+			return(-1);
+		}
+		src->length = n * 3 / 2;
+		break;
+	case SRC_PAL_YUV420P:
+		if((w | h) & 1)
+		{
+			ERROR("YUV420P needs an even width and height.");
+			return(-1);
+		}
+		src->length = n * 3 / 2;
+		break;
+	case SRC_PAL_BAYER:
+	case SRC_PAL_SGBRG8:
+	case SRC_PAL_SGRBG8:
+	case SRC_PAL_GREY:
+		src->length = n;
+		break;
+	default:
+		ERROR("Palette format not supported by test source.");
+		return(-1);
+	}
+	
+	src->img = malloc(src->length);
+	if(!src->img) return(-1);
+	
+	d   = (uint8_t *) src->img;
+	d16 = (uint16_t *) src->img;
+	
+	switch(src->palette)
+	{
+	case SRC_PAL_RGB32:
+	case SRC_PAL_BGR32:
+		for(i = 0, p = rgb; i < n; i++, p += 3, d += 4)
+		{
+			if(src->palette == SRC_PAL_RGB32) { PUT_RGB(d, p[0], p[1], p[2]); }
+			else { PUT_RGB(d, p[2], p[1], p[0]); }
+			d[3] = 0;
+		}
+		break;
+	case SRC_PAL_BGR24:
+		for(i = 0, p = rgb; i < n; i++, p += 3, d += 3)
+			PUT_RGB(d, p[2], p[1], p[0]);
+		break;
+	case SRC_PAL_RGB565:
+		for(i = 0, p = rgb; i < n; i++, p += 3)
+			d16[i] = ((p[0] >> 3) << 11) | ((p[1] >> 2) << 5) | (p[2] >> 3);
+		break;
+	case SRC_PAL_RGB555:
+		for(i = 0, p = rgb; i < n; i++, p += 3)
+			d16[i] = ((p[0] >> 3) << 10) | ((p[1] >> 3) << 5) | (p[2] >> 3);
+		break;
+	case SRC_PAL_Y16:
+	case SRC_PAL_GREY:
+		for(i = 0, p = rgb; i < n; i++, p += 3)
+		{
+			src_test_yuv(p, &cy, &cu, &cv);
+			if(src->palette == SRC_PAL_GREY) d[i] = cy;
+			else d16[i] = (cy << 8) | cy;
+		}
+		break;
+	case SRC_PAL_YUYV:
+	case SRC_PAL_UYVY:
+		/* Each pair of pixels shares the chroma of the first. */
+		for(i = 0, p = rgb; i < n; i++, p += 3, d += 2)
+		{
+			int c;
+			
+			src_test_yuv(p - (i & 1) * 3, &cy, &cu, &cv);
+			c = (i & 1 ? cv : cu);
+			src_test_yuv(p, &cy, &cu, &cv);
+			
+			if(src->palette == SRC_PAL_YUYV) { d[0] = cy; d[1] = c; }
+			else { d[0] = c; d[1] = cy; }
+		}
+		break;
+	case SRC_PAL_YUV420P:
+	case SRC_PAL_NV12MB:
+		for(y = 0; y < h; y++)
+			for(x = 0; x < w; x++)
+			{
+				uint32_t bx = x >> 4, by = y >> 4;
+				uint8_t *py, *puv;
+				
+				src_test_yuv(rgb + (y * w + x) * 3, &cy, &cu, &cv);
+				
+				if(src->palette == SRC_PAL_YUV420P)
+				{
+					d[y * w + x] = cy;
+					if((x | y) & 1) continue;
+					
+					d[n + (y / 2) * (w / 2) + x / 2] = cu;
+					d[n + n / 4 + (y / 2) * (w / 2) + x / 2] = cv;
+					continue;
+				}
+				
+				/* 16x16 tiles of luma, and of interleaved
+				 * chroma for each pair of tile rows. */
+				py = d + ((by * (w >> 4)) + bx) * 0x100;
+				py[((y & 0xF) * 0x10) + (x & 0xF)] = cy;
+				if((x | y) & 1) continue;
+				
+				puv  = d + n + (((by / 2) * (w >> 4)) + bx) * 0x100;
+				puv += (((y / 2) - ((by / 2) << 4)) * 0x10) + (x & 0xF);
+				puv[0] = cu;
+				puv[1] = cv;
+			}
+		break;
+	case SRC_PAL_BAYER:
+	case SRC_PAL_SGBRG8:
+	case SRC_PAL_SGRBG8:
+		/* The colour each pixel keeps: SBGGR8 starts BG/GR,
+		 * SGBRG8 GB/RG and SGRBG8 GR/BG. */
+		for(y = 0; y < h; y++)
+			for(x = 0; x < w; x++)
+			{
+				int g = (src->palette == SRC_PAL_BAYER ? (x + y) & 1 : ~(x + y) & 1);
+				int c;
+				
+				p = rgb + (y * w + x) * 3;
+				
+				if(g) c = p[1];
+				else if(src->palette == SRC_PAL_SGRBG8) c = (y & 1 ? p[2] : p[0]);
+				else c = (y & 1 ? p[0] : p[2]);
+				
+				d[y * w + x] = c;
+			}
+		break;
+	}
+	
+	return(0);
+}
+
 int src_test_open(src_t *src)
 {
-	uint8_t *p;
+	uint8_t *p, *rgb;
 	uint32_t x, y;
 	
 	if(src->list & SRC_LIST_INPUTS) HEAD("--- No inputs.");
 	if(src->list & SRC_LIST_TUNERS) HEAD("--- No tuners.");
-	if(src->list & SRC_LIST_FORMATS) HEAD("--- Test only supports RGB24.");
+	if(src->list & SRC_LIST_FORMATS) HEAD("--- Test supports every palette but S561.");
 	if(src->list & SRC_LIST_CONTROLS) HEAD("--- No controls.");
 	
 	/* Allocate memory for the test image. */
-	src->length = src->width * src->height * 3;
-	src->img    = (uint8_t *) malloc(src->length);
-	if(!src->img) return(-1);
-	
-	/* Set the palette type. */
-	src->palette = SRC_PAL_RGB24;
+	rgb = (uint8_t *) malloc(src->width * src->height * 3);
+	if(!rgb) return(-1);
 	
 	/* Draw the test image. */
-	p = src->img;
+	p = rgb;
 	for(y = 0; y < src->height; y++)
 	{
 		for(x = 0; x < src->width; x++)
@@ -69,6 +299,24 @@ int src_test_open(src_t *src)
 		}
 	}
 	
+	/* RGB24 is the default. */
+	if(src->palette == SRC_PAL_ANY || src->palette == SRC_PAL_RGB24)
+	{
+		src->palette = SRC_PAL_RGB24;
+		src->length  = src->width * src->height * 3;
+		src->img     = rgb;
+		
+		return(0);
+	}
+	
+	if(src_test_convert(src, rgb))
+	{
+		free(rgb);
+		return(-1);
+	}
+	
+	free(rgb);
+	
 	return(0);
 }
 
@@ -87,6 +335,6 @@ src_mod_t src_test = {
 	"test", SRC_TYPE_NONE,
 	src_test_open,
 	src_test_close,
-	src_test_grab
+	src_test_grab,
+	NULL
 };
-
@@ -947,6 +947,7 @@ src_mod_t src_v4l1 = {
 	src_v4l_open,
 	src_v4l_close,
 	src_v4l_grab,
+	NULL
 };
 
 #else /* #ifdef HAVE_V4L1 */
@@ -955,6 +956,7 @@ src_mod_t src_v4l1 = {
         "", SRC_TYPE_NONE,
         NULL,
         NULL,
+        NULL,
         NULL
 };
 
@@ -970,6 +970,13 @@ static int src_v4l2_grab(src_t *src)
 		src->img    = s->buffer[s->buf.index].start;
 		src->length = s->buffer[s->buf.index].length;
 		
+		/* Compressed frames only fill part of the buffer. */
+		if(s->buf.bytesused && s->buf.bytesused < src->length)
+			src->length = s->buf.bytesused;
+		
+		src->timestamp = s->buf.timestamp;
+		src->sequence  = s->buf.sequence;
+		
 		s->pframe = s->buf.index;
 	}
 	else
@@ -991,11 +998,61 @@ static int src_v4l2_grab(src_t *src)
 	return(0);
 }
 
+static int src_v4l2_reset(src_t *src)
+{
+	src_v4l2_t *s = (src_v4l2_t *) src->state;
+	enum v4l2_buf_type type;
+	uint32_t b;
+	
+	/* Nothing is queued when using read(). */
+	if(!s->map) return(0);
+	
+	/* Stopping the stream returns all buffers to the application,
+	 * they can then be queued again without renegotiating the
+	 * format or remapping the buffers. */
+	type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	
+	if(ioctl(s->fd, VIDIOC_STREAMOFF, &type) == -1)
+	{
+		ERROR("Error stopping stream.");
+		ERROR("VIDIOC_STREAMOFF: %s", strerror(errno));
+		return(-1);
+	}
+	
+	for(b = 0; b < s->req.count; b++)
+	{
+		memset(&s->buf, 0, sizeof(s->buf));
+		
+		s->buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		s->buf.memory = V4L2_MEMORY_MMAP;
+		s->buf.index  = b;
+		
+		if(ioctl(s->fd, VIDIOC_QBUF, &s->buf) == -1)
+		{
+			ERROR("VIDIOC_QBUF: %s", strerror(errno));
+			return(-1);
+		}
+	}
+	
+	if(ioctl(s->fd, VIDIOC_STREAMON, &type) == -1)
+	{
+		ERROR("Error restarting stream.");
+		ERROR("VIDIOC_STREAMON: %s", strerror(errno));
+		return(-1);
+	}
+	
+	/* No buffer is held by us any more. */
+	s->pframe = -1;
+	
+	return(0);
+}
+
 src_mod_t src_v4l2 = {
 	"v4l2", SRC_TYPE_DEVICE,
 	src_v4l2_open,
 	src_v4l2_close,
-	src_v4l2_grab
+	src_v4l2_grab,
+	src_v4l2_reset
 };
 
 #else /* #ifdef HAVE_V4L2 */
@@ -1004,6 +1061,7 @@ src_mod_t src_v4l2 = {
 	"", SRC_TYPE_NONE,
         NULL,
         NULL,
+        NULL,
         NULL
 };
 
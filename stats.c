@@ -0,0 +1,216 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2011 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "stats.h"
+#include "log.h"
+
+#define STATS_STAGES (32)
+
+/* Times are kept in microseconds. Below 4 each value has its own
+ * bucket, above that each power of two is split into four buckets,
+ * so a bucket is never more than 25% wide. The last bucket holds
+ * everything from 2^36us (about 19 hours) up. */
+#define STATS_BUCKETS (144)
+
+typedef struct {
+	
+	const char *name;
+	
+	uint64_t count;
+	uint64_t total;
+	uint64_t max;
+	
+	uint32_t bucket[STATS_BUCKETS];
+	
+} stats_stage_t;
+
+static struct {
+	
+	pthread_mutex_t lock;
+	
+	stats_stage_t stage[STATS_STAGES];
+	int stages;
+	
+} stats = { PTHREAD_MUTEX_INITIALIZER };
+
+static int stats_bucket(uint64_t us)
+{
+	int e;
+	
+	if(us < 4) return(us);
+	
+	e = 63 - __builtin_clzll(us);
+	if(e > 36) return(STATS_BUCKETS - 1);
+	
+	return((e - 1) * 4 + ((us >> (e - 2)) & 3));
+}
+
+/* The largest value that goes in bucket b. */
+static uint64_t stats_bucket_max(int b)
+{
+	int e = b / 4 + 1;
+	
+	if(b < 4) return(b);
+	
+	return(((uint64_t) (4 + b % 4) << (e - 2)) + ((uint64_t) 1 << (e - 2)) - 1);
+}
+
+/* The value that a fraction p of the samples are at or below, to
+ * the resolution of the buckets. */
+static uint64_t stats_percentile(stats_stage_t *s, double p)
+{
+	uint64_t n = 0, want;
+	int b;
+	
+	want = (uint64_t) (p * s->count + 0.999999);
+	if(want < 1) want = 1;
+	
+	for(b = 0; b < STATS_BUCKETS; b++)
+	{
+		n += s->bucket[b];
+		if(n >= want) break;
+	}
+	
+	if(b == STATS_BUCKETS || stats_bucket_max(b) > s->max) return(s->max);
+	
+	return(stats_bucket_max(b));
+}
+
+int64_t stats_clock(void)
+{
+	struct timespec t;
+	
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	
+	return((int64_t) t.tv_sec * 1000000000LL + t.tv_nsec);
+}
+
+int64_t stats_lap(const char *stage, int64_t start)
+{
+	int64_t now = stats_clock();
+	uint64_t us = (now > start ? (now - start) / 1000 : 0);
+	stats_stage_t *s = NULL;
+	int i;
+	
+	pthread_mutex_lock(&stats.lock);
+	
+	for(i = 0; i < stats.stages; i++)
+	{
+		if(strcmp(stats.stage[i].name, stage)) continue;
+		s = &stats.stage[i];
+		break;
+	}
+	
+	if(!s && stats.stages < STATS_STAGES)
+	{
+		s = &stats.stage[stats.stages++];
+		s->name = stage;
+	}
+	
+	if(s)
+	{
+		s->count++;
+		s->total += us;
+		if(us > s->max) s->max = us;
+		s->bucket[stats_bucket(us)]++;
+	}
+	
+	pthread_mutex_unlock(&stats.lock);
+	
+	return(now);
+}
+
+static void stats_json(char *filename, stats_stage_t *stage, int stages)
+{
+	FILE *f;
+	int i;
+	
+	f = fopen(filename, "w");
+	if(!f)
+	{
+		ERROR("Unable to write statistics to '%s'", filename);
+		ERROR("fopen: %s", strerror(errno));
+		return;
+	}
+	
+	fprintf(f, "{\n\t\"unit\": \"us\",\n\t\"stages\": [");
+	
+	for(i = 0; i < stages; i++)
+	{
+		stats_stage_t *s = &stage[i];
+		
+		fprintf(f, "%s\n\t\t{ \"name\": \"%s\", \"count\": %llu, "
+		        "\"mean\": %llu, \"p50\": %llu, \"p95\": %llu, "
+		        "\"p99\": %llu, \"max\": %llu }",
+		        (i ? "," : ""), s->name,
+		        (unsigned long long) s->count,
+		        (unsigned long long) (s->total / s->count),
+		        (unsigned long long) stats_percentile(s, 0.50),
+		        (unsigned long long) stats_percentile(s, 0.95),
+		        (unsigned long long) stats_percentile(s, 0.99),
+		        (unsigned long long) s->max);
+	}
+	
+	fprintf(f, "\n\t]\n}\n");
+	
+	if(fclose(f))
+		ERROR("Error writing statistics to '%s': %s", filename,
+		      strerror(errno));
+}
+
+void stats_report(char *filename)
+{
+	stats_stage_t stage[STATS_STAGES];
+	int i, stages;
+	
+	/* Work from a copy, the other threads carry on adding to it. */
+	pthread_mutex_lock(&stats.lock);
+	stages = stats.stages;
+	memcpy(stage, stats.stage, sizeof(stats_stage_t) * stages);
+	pthread_mutex_unlock(&stats.lock);
+	
+	if(!stages) return;
+	
+	MSG("Stage timings (ms):");
+	MSG("%-14s %8s %9s %9s %9s %9s %9s", "stage", "count",
+	    "mean", "p50", "p95", "p99", "max");
+	
+	for(i = 0; i < stages; i++)
+	{
+		stats_stage_t *s = &stage[i];
+		
+		MSG("%-14s %8llu %9.3f %9.3f %9.3f %9.3f %9.3f", s->name,
+		    (unsigned long long) s->count,
+		    (double) s->total / s->count / 1000,
+		    (double) stats_percentile(s, 0.50) / 1000,
+		    (double) stats_percentile(s, 0.95) / 1000,
+		    (double) stats_percentile(s, 0.99) / 1000,
+		    (double) s->max / 1000);
+	}
+	
+	if(filename) stats_json(filename, stage, stages);
+}
+
+void stats_reset(void)
+{
+	pthread_mutex_lock(&stats.lock);
+	memset(stats.stage, 0, sizeof(stats.stage));
+	stats.stages = 0;
+	pthread_mutex_unlock(&stats.lock);
+}
+
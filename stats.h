@@ -0,0 +1,34 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2011 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+#ifndef INC_STATS_H
+#define INC_STATS_H
+
+#include <stdint.h>
+
+/* Latency of each stage of a shot, kept in a histogram per stage.
+ * Stages are named by string constants and are created the first
+ * time they are used. Any thread can add to them. */
+
+/* CLOCK_MONOTONIC in nanoseconds. */
+extern int64_t stats_clock(void);
+
+/* Adds the time since start to the stage, and returns the time now
+ * so the next stage can start from it. */
+extern int64_t stats_lap(const char *stage, int64_t start);
+
+/* Logs the count, mean, p50, p95, p99 and maximum of every stage. If
+ * filename is set the same is written there as JSON. */
+extern void stats_report(char *filename);
+
+/* Forget every stage. */
+extern void stats_reset(void);
+
+#endif
+
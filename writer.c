@@ -0,0 +1,433 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2011 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+#ifdef __linux__
+#define _GNU_SOURCE /* For syncfs() */
+#endif
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "writer.h"
+#include "stats.h"
+#include "log.h"
+
+typedef struct {
+	char filename[FILENAME_MAX];
+	uint8_t *data;
+	unsigned long length;
+	unsigned long size; /* Allocated size of data */
+} writer_file_t;
+
+static struct {
+	
+	pthread_t thread;
+	char running;
+	
+	/* Protects everything below. */
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	
+	writer_file_t **file;
+	int size;
+	int head;
+	int count;
+	int policy;
+	char busy;
+	char stop;
+	
+	/* Files already written, kept with their buffers for reuse. */
+	writer_file_t **spare;
+	int spares;
+	
+	/* Files are synced every sync files. Without the thread more
+	 * than one thread can be writing, eg. with --pipeline. */
+	int sync;
+	int unsynced;
+	
+	/* Statistics. */
+	unsigned int written;
+	unsigned int dropped;
+	unsigned int failed;
+	int deepest;
+	
+} writer;
+
+/* Keep the file for reuse, or free it if there are enough spare.
+ * Called with the lock held. */
+static void writer_recycle(writer_file_t *file)
+{
+	if(writer.spares < writer.size + 2)
+	{
+		writer.spare[writer.spares++] = file;
+		return;
+	}
+	
+	free(file->data);
+	free(file);
+}
+
+static int writer_stdout(writer_file_t *file)
+{
+	if(fwrite(file->data, 1, file->length, stdout) != file->length ||
+	   fflush(stdout))
+	{
+		ERROR("Error writing to stdout: %s", strerror(errno));
+		return(-1);
+	}
+	
+	return(0);
+}
+
+/* Flush the data to disk, every file or every writer.sync files. */
+static int writer_sync(int fd)
+{
+	int64_t t = stats_clock();
+	int r = 0;
+	
+	if(!writer.sync) return(0);
+	if(writer.sync == 1) r = fdatasync(fd);
+	else
+	{
+		int batch;
+		
+		pthread_mutex_lock(&writer.lock);
+		batch = (++writer.unsynced >= writer.sync);
+		if(batch) writer.unsynced = 0;
+		pthread_mutex_unlock(&writer.lock);
+		
+		if(!batch) return(0);
+		
+		/* One call for the whole batch. */
+#ifdef __linux__
+		r = syncfs(fd);
+#else
+		sync();
+#endif
+	}
+	
+	stats_lap("sync", t);
+	
+	return(r);
+}
+
+static int writer_write(writer_file_t *file)
+{
+	char tmp[FILENAME_MAX];
+	uint8_t *p = file->data;
+	unsigned long n = file->length;
+	char *base;
+	ssize_t w;
+	int fd, e;
+	
+	if(!strncmp(file->filename, "-", 2)) return(writer_stdout(file));
+	
+	/* The image is written to a hidden file in the same directory
+	 * and renamed into place, so it's never seen half written. */
+	base = strrchr(file->filename, '/');
+	base = (base ? base + 1 : file->filename);
+	
+	if(snprintf(tmp, FILENAME_MAX, "%.*s.%s.%u.tmp",
+	            (int) (base - file->filename), file->filename, base,
+	            (unsigned int) getpid()) >= FILENAME_MAX)
+	{
+		ERROR("Filename is too long: %s", file->filename);
+		return(-1);
+	}
+	
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if(fd < 0)
+	{
+		ERROR("Error opening file for output: %s", tmp);
+		ERROR("open: %s", strerror(errno));
+		return(-1);
+	}
+	
+	/* Normally this is a single write. */
+	while(n)
+	{
+		w = write(fd, p, n);
+		if(w < 0 && errno == EINTR) continue;
+		if(w <= 0) break;
+		
+		p += w;
+		n -= w;
+	}
+	
+	if(n || writer_sync(fd))
+	{
+		e = errno;
+		close(fd);
+	}
+	else if(close(fd)) e = errno;
+	else if(rename(tmp, file->filename)) e = errno;
+	else return(0);
+	
+	ERROR("Error writing to '%s': %s", file->filename, strerror(e));
+	unlink(tmp);
+	
+	return(-1);
+}
+
+static void *writer_thread(void *arg)
+{
+	writer_file_t *file;
+	int64_t t;
+	int r;
+	
+	pthread_mutex_lock(&writer.lock);
+	
+	while(1)
+	{
+		while(!writer.count && !writer.stop)
+			pthread_cond_wait(&writer.changed, &writer.lock);
+		
+		/* Everything queued is written before stopping. */
+		if(!writer.count) break;
+		
+		file = writer.file[writer.head];
+		writer.head = (writer.head + 1) % writer.size;
+		writer.count--;
+		writer.busy = 1;
+		pthread_cond_broadcast(&writer.changed);
+		
+		pthread_mutex_unlock(&writer.lock);
+		t = stats_clock();
+		r = writer_write(file);
+		stats_lap("write", t);
+		pthread_mutex_lock(&writer.lock);
+		
+		writer_recycle(file);
+		
+		if(r) writer.failed++;
+		else writer.written++;
+		
+		writer.busy = 0;
+		pthread_cond_broadcast(&writer.changed);
+	}
+	
+	pthread_mutex_unlock(&writer.lock);
+	
+	return(NULL);
+}
+
+int writer_init(int size, int policy, int sync)
+{
+	if(size < 0) size = 0;
+	
+	memset(&writer, 0, sizeof(writer));
+	pthread_mutex_init(&writer.lock, NULL);
+	pthread_cond_init(&writer.changed, NULL);
+	
+	writer.policy = policy;
+	writer.sync   = sync;
+	
+	writer.spare = calloc(size + 2, sizeof(writer_file_t *));
+	if(size) writer.file = calloc(size, sizeof(writer_file_t *));
+	
+	if(!writer.spare || (size && !writer.file))
+	{
+		ERROR("Out of memory.");
+		return(-1);
+	}
+	
+	if(!size) return(0);
+	
+	writer.size = size;
+	
+	if(pthread_create(&writer.thread, NULL, writer_thread, NULL))
+	{
+		WARN("Unable to start the writer thread.");
+		writer.size = 0;
+		return(0);
+	}
+	
+	writer.running = 1;
+	DEBUG("Writing files in the background, up to %i queued.", size);
+	
+	return(0);
+}
+
+void writer_free(void)
+{
+	if(writer.running)
+	{
+		pthread_mutex_lock(&writer.lock);
+		writer.stop = 1;
+		pthread_cond_broadcast(&writer.changed);
+		pthread_mutex_unlock(&writer.lock);
+		
+		pthread_join(writer.thread, NULL);
+		
+		MSG("Writer: %u written, %u dropped, %u failed, %i queued at most.",
+		    writer.written, writer.dropped, writer.failed, writer.deepest);
+	}
+	
+	/* Flush the rest of the last batch. */
+	if(writer.unsynced) sync();
+	
+	while(writer.spares)
+	{
+		writer_file_t *file = writer.spare[--writer.spares];
+		
+		free(file->data);
+		free(file);
+	}
+	
+	free(writer.spare);
+	free(writer.file);
+	
+	memset(&writer, 0, sizeof(writer));
+}
+
+int writer_policy(char *value)
+{
+	if(!strcmp(value, "block")) return(WRITER_BLOCK);
+	if(!strcmp(value, "drop-oldest")) return(WRITER_DROP_OLDEST);
+	if(!strcmp(value, "drop-newest")) return(WRITER_DROP_NEWEST);
+	
+	ERROR("Unknown writer policy: %s", value);
+	
+	return(-1);
+}
+
+void writer_buffer(uint8_t **data, unsigned long *size)
+{
+	int i;
+	
+	*data = NULL;
+	*size = 0;
+	
+	pthread_mutex_lock(&writer.lock);
+	
+	for(i = writer.spares - 1; i >= 0; i--)
+	{
+		if(!writer.spare[i]->data) continue;
+		
+		*data = writer.spare[i]->data;
+		*size = writer.spare[i]->size;
+		writer.spare[i]->data = NULL;
+		writer.spare[i]->size = 0;
+		break;
+	}
+	
+	pthread_mutex_unlock(&writer.lock);
+}
+
+int writer_push(char *filename, uint8_t *data, unsigned long length,
+                unsigned long size)
+{
+	writer_file_t *file = NULL, *old = NULL;
+	int i, r;
+	
+	pthread_mutex_lock(&writer.lock);
+	
+	/* Take a spare, preferably one whose buffer was already taken
+	 * by writer_buffer(). */
+	for(i = writer.spares - 1; i > 0 && writer.spare[i]->data; i--);
+	
+	if(writer.spares)
+	{
+		file = writer.spare[i];
+		writer.spare[i] = writer.spare[--writer.spares];
+		free(file->data);
+	}
+	
+	pthread_mutex_unlock(&writer.lock);
+	
+	if(!file) file = malloc(sizeof(writer_file_t));
+	if(!file)
+	{
+		ERROR("Out of memory.");
+		free(data);
+		return(-1);
+	}
+	
+	strncpy(file->filename, filename, FILENAME_MAX - 1);
+	file->filename[FILENAME_MAX - 1] = '\0';
+	file->data   = data;
+	file->length = length;
+	file->size   = size;
+	
+	/* Without the thread the file is written here. */
+	if(!writer.running)
+	{
+		int64_t t = stats_clock();
+		
+		r = writer_write(file);
+		stats_lap("write", t);
+		
+		pthread_mutex_lock(&writer.lock);
+		writer_recycle(file);
+		pthread_mutex_unlock(&writer.lock);
+		
+		return(r);
+	}
+	
+	pthread_mutex_lock(&writer.lock);
+	
+	if(writer.count == writer.size)
+	{
+		if(writer.policy == WRITER_DROP_NEWEST)
+		{
+			old = file;
+			file = NULL;
+		}
+		else if(writer.policy == WRITER_DROP_OLDEST)
+		{
+			old = writer.file[writer.head];
+			writer.head = (writer.head + 1) % writer.size;
+			writer.count--;
+		}
+		else while(writer.count == writer.size)
+			pthread_cond_wait(&writer.changed, &writer.lock);
+	}
+	
+	if(old)
+	{
+		WARN("Writer queue is full, dropping '%s'.", old->filename);
+		writer.dropped++;
+		writer_recycle(old);
+	}
+	
+	if(file)
+	{
+		writer.file[(writer.head + writer.count) % writer.size] = file;
+		writer.count++;
+		if(writer.count > writer.deepest) writer.deepest = writer.count;
+		
+		DEBUG("Writer queue: %i of %i.", writer.count, writer.size);
+		pthread_cond_broadcast(&writer.changed);
+	}
+	
+	pthread_mutex_unlock(&writer.lock);
+	
+	return(file ? 0 : -1);
+}
+
+void writer_flush(void)
+{
+	if(!writer.running) return;
+	
+	pthread_mutex_lock(&writer.lock);
+	
+	while(writer.count || writer.busy)
+		pthread_cond_wait(&writer.changed, &writer.lock);
+	
+	pthread_mutex_unlock(&writer.lock);
+}
+
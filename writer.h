@@ -0,0 +1,52 @@
+/* fswebcam - Small and simple webcam for *nix                */
+/*============================================================*/
+/* Copyright (C)2005-2011 Philip Heron <phil@sanslogic.co.uk> */
+/*                                                            */
+/* This program is distributed under the terms of the GNU     */
+/* General Public License, version 2. You may use, modify,    */
+/* and redistribute it under the terms of this license. A     */
+/* copy should be included with this source.                  */
+
+#ifndef INC_WRITER_H
+#define INC_WRITER_H
+
+#include <stdint.h>
+
+/* What writer_push() does when the queue is full. */
+#define WRITER_BLOCK       (0) /* Wait for the writer to make room */
+#define WRITER_DROP_OLDEST (1) /* Discard the oldest waiting file */
+#define WRITER_DROP_NEWEST (2) /* Discard the new file */
+
+/* Writes finished images to disk on a thread of its own, so a slow
+ * disk doesn't hold up the capture. There is only one writer, set up
+ * by writer_init(). With a queue size of 0, or without it, files are
+ * written by the caller of writer_push(). */
+
+/* Starts the writer with room for size files. A sync of 1 flushes
+ * each file to disk before it's renamed into place, n flushes the
+ * filesystem once every n files and 0 leaves it to the system. */
+extern int writer_init(int size, int policy, int sync);
+extern void writer_free(void);
+
+/* Parses "block", "drop-oldest" or "drop-newest". Returns -1 if the
+ * policy is unknown. */
+extern int writer_policy(char *value);
+
+/* Returns a buffer from a file already written and its allocated
+ * size, or NULL and 0 if there is none. Passing it back through
+ * writer_push() means no memory is allocated once running. */
+extern void writer_buffer(uint8_t **data, unsigned long *size);
+
+/* Queues length bytes of data to be written to filename, or stdout
+ * for "-". Files are written to a temporary name and renamed, so they
+ * appear complete. The writer takes the buffer, which must come from
+ * malloc() and holds size bytes. Returns 0 if the file was queued or
+ * written, -1 on error or if it was dropped. */
+extern int writer_push(char *filename, uint8_t *data, unsigned long length,
+                       unsigned long size);
+
+/* Waits for all queued files to be written. */
+extern void writer_flush(void);
+
+#endif
+